@@ -0,0 +1,503 @@
+// Throughput and latency of ComLib between two processes
+// Usage: ComBench [csv|json] [MB per case] [mode] [wait]
+// Sweeps mode, ring size, message size and wait strategy. Each case spawns a producer and a consumer
+// process, the consumer prints one result row to stdout. Progress and errors go to stderr.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "ComLib.h"
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#endif
+
+// How long the consumer waits for the next message before it gives up on a case
+#define BENCH_TIMEOUT_MS 10000
+// Most messages a case sends, small messages would take too long to reach the byte budget otherwise
+#define BENCH_MAXMESSAGES 1000000
+// Messages sent one at a time for the latency pass
+#define BENCH_LATENCYMESSAGES 10000
+// Threads sending the throughput pass at once in MPSC
+#define BENCH_PRODUCERS 4
+
+// What a process does while the ring is empty (consumer) or full (producer)
+enum WAIT { SPIN, YIELD, SLEEP };
+
+const char* modeNames[] = { "LOCKED", "SPSC", "BROADCAST", "MPSC" };
+const char* waitNames[] = { "SPIN", "YIELD", "SLEEP" };
+
+// Camera, transform, small mesh, large meshes
+const size_t messageSizes[] = { 64, 1 << 10, 64 << 10, 1 << 20, 4 << 20 };
+const size_t ringSizes[] = { 1 << 20, 16 << 20 };
+
+// Starts every message, the rest of it is filler
+struct Stamp
+{
+	long long sent;			// steady_clock ns, the clock is system wide so both processes share it
+	size_t producer;		// Thread that sent it
+	size_t sequence;		// Counts the messages of the producer thread in the pass
+	size_t pass;			// 0 throughput, 1 latency
+};
+
+struct Case
+{
+	ComLib::MODE mode;
+	size_t ringSize;
+	size_t messageSize;
+	WAIT wait;
+	size_t count;			// Messages in the throughput pass
+	size_t latencyCount;	// Messages in the latency pass
+};
+
+long long now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void wait(const WAIT strategy)
+{
+	if (strategy == YIELD)
+		std::this_thread::yield();
+	else if (strategy == SLEEP)
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+std::string caseArgs(const std::string& secret, const Case& c)
+{
+	return secret + " " + std::to_string(c.mode) + " " + std::to_string(c.ringSize) + " " + std::to_string(c.messageSize) + " " +
+		std::to_string(c.wait) + " " + std::to_string(c.count) + " " + std::to_string(c.latencyCount);
+}
+
+Case parseCase(char* argv[])
+{
+	Case c;
+	c.mode = (ComLib::MODE)atoi(argv[0]);
+	c.ringSize = strtoull(argv[1], nullptr, 10);
+	c.messageSize = strtoull(argv[2], nullptr, 10);
+	c.wait = (WAIT)atoi(argv[3]);
+	c.count = strtoull(argv[4], nullptr, 10);
+	c.latencyCount = strtoull(argv[5], nullptr, 10);
+
+	return c;
+}
+
+// Threads sending the throughput pass, the latency pass is sent by the first
+size_t producerThreads(const Case& c)
+{
+	return (c.mode == ComLib::MPSC) ? BENCH_PRODUCERS : 1;
+}
+
+// Messages of the throughput pass a producer thread sends, every threads-th from its own index
+size_t producerCount(const Case& c, const size_t thread)
+{
+	const size_t threads = producerThreads(c);
+
+	return (thread < c.count) ? (c.count - thread + threads - 1) / threads : 0;
+}
+
+// Stamps and sends msg, retrying while the ring is full. False if the consumer stopped reading.
+bool send(ComLib& comlib, std::vector<char>& msg, const WAIT strategy)
+{
+	Stamp* stamp = reinterpret_cast<Stamp*>(msg.data());
+	const long long start = now();
+
+	do
+	{
+		stamp->sent = now(); // Latency counts from the send that got through
+
+		if (comlib.send(msg.data(), msg.size()))
+			return true;
+
+		wait(strategy);
+	} while (now() - start < BENCH_TIMEOUT_MS * 1000000ll);
+
+	fprintf(stderr, "Consumer stopped reading.\n");
+	return false;
+}
+
+// Waits until the consumer has read everything sent so far
+bool drained(ComLib& comlib, const WAIT strategy)
+{
+	const long long start = now();
+
+	while (comlib.consumed(0) != comlib.written(0))
+	{
+		if (now() - start > BENCH_TIMEOUT_MS * 1000000ll)
+		{
+			fprintf(stderr, "Consumer stopped reading.\n");
+			return false;
+		}
+
+		wait(strategy);
+	}
+
+	return true;
+}
+
+int producer(const std::string& secret, const Case& c)
+{
+	ComLib comlib(secret, c.ringSize, c.mode, c.mode != ComLib::LOCKED);
+
+	// A BROADCAST producer reuses space nobody is reading, so nothing may be sent before the consumer joined
+	if (c.mode == ComLib::BROADCAST)
+	{
+		const long long start = now();
+
+		while (comlib.stats().readers == 0)
+		{
+			if (now() - start > BENCH_TIMEOUT_MS * 1000000ll)
+				return 1;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	// Throughput: as fast as the ring takes them. MPSC splits the messages over BENCH_PRODUCERS threads.
+	const size_t threads = producerThreads(c);
+	std::vector<std::thread> workers;
+	std::atomic<bool> failed(false);
+
+	for (size_t t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]()
+		{
+			std::vector<char> msg(c.messageSize, 'x');
+			Stamp* stamp = reinterpret_cast<Stamp*>(msg.data());
+
+			for (size_t i = 0; i < producerCount(c, t) && !failed; i++)
+			{
+				stamp->producer = t;
+				stamp->sequence = i;
+				stamp->pass = 0;
+
+				if (!send(comlib, msg, c.wait))
+					failed = true;
+			}
+		});
+	}
+
+	for (std::thread& worker : workers)
+		worker.join();
+
+	if (failed)
+		return 1;
+
+	std::vector<char> msg(c.messageSize, 'x');
+	Stamp* stamp = reinterpret_cast<Stamp*>(msg.data());
+
+	// Latency: one message in flight at a time, so nothing queues up in front of it
+	for (size_t i = 0; i < c.latencyCount; i++)
+	{
+		if (!drained(comlib, c.wait))
+			return 1;
+
+		stamp->producer = 0;
+		stamp->sequence = i;
+		stamp->pass = 1;
+
+		if (!send(comlib, msg, c.wait))
+			return 1;
+	}
+
+	// Leaving is safe with messages still in the ring, the segment lives on while the consumer is attached
+	return 0;
+}
+
+double percentile(std::vector<long long>& samples, const double p)
+{
+	if (samples.empty())
+		return 0.0;
+
+	const size_t index = std::min(samples.size() - 1, (size_t)(p * samples.size()));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+
+	return samples[index] / 1000.0;
+}
+
+int consumer(const std::string& secret, const Case& c, const bool json, const bool first)
+{
+	ComLib comlib(secret, c.ringSize, c.mode, c.mode != ComLib::LOCKED);
+
+	std::vector<long long> loaded;
+	std::vector<long long> latency;
+	loaded.reserve(c.count);
+	latency.reserve(c.latencyCount);
+
+	long long firstSent = 0;
+	long long lastReceived = 0;
+	long long lastMessage = now();
+	std::vector<size_t> expected(producerThreads(c), 0);	// Next sequence of each producer thread
+	bool latencyPass = false;
+	size_t lost = 0;
+
+	// Joins a BROADCAST segment, the producer waits for that
+	comlib.nextLength();
+
+	while (loaded.size() + latency.size() + lost < c.count + c.latencyCount)
+	{
+		size_t length = 0;
+		const char* msg = comlib.peek(length);
+
+		if (msg == nullptr)
+		{
+			if (now() - lastMessage > BENCH_TIMEOUT_MS * 1000000ll)
+			{
+				fprintf(stderr, "Timed out after %zu of %zu messages.\n", loaded.size() + latency.size(), c.count + c.latencyCount);
+				return 1;
+			}
+
+			wait(c.wait);
+			continue;
+		}
+
+		const long long received = now();
+		const Stamp* stamp = reinterpret_cast<const Stamp*>(msg);
+
+		if (stamp->pass == 0)
+		{
+			if (loaded.empty())
+				firstSent = stamp->sent;
+
+			lastReceived = received;
+			loaded.push_back(received - stamp->sent);
+		}
+		else
+		{
+			latency.push_back(received - stamp->sent);
+		}
+
+		// Counts messages that never arrived, so the loop still ends.
+		// Each producer thread numbers its own, MPSC threads interleave in the ring but keep their order.
+		if (stamp->pass == 1 && !latencyPass)
+		{
+			// The latency pass starts after every thread's throughput pass, what is missing of those was lost
+			for (size_t t = 0; t < expected.size(); t++)
+			{
+				lost += producerCount(c, t) - expected[t];
+				expected[t] = 0;
+			}
+
+			latencyPass = true;
+		}
+
+		if (stamp->sequence > expected[stamp->producer])
+			lost += stamp->sequence - expected[stamp->producer];
+
+		expected[stamp->producer] = stamp->sequence + 1;
+		lastMessage = received;
+
+		comlib.release();
+	}
+
+	const double seconds = (lastReceived - firstSent) / 1e9;
+	const double messagesPerSecond = (seconds > 0.0) ? loaded.size() / seconds : 0.0;
+	const double gigabytesPerSecond = messagesPerSecond * c.messageSize / 1e9;
+
+	const double loadedP50 = percentile(loaded, 0.5);
+	const double loadedP99 = percentile(loaded, 0.99);
+	const double p50 = percentile(latency, 0.5);
+	const double p99 = percentile(latency, 0.99);
+	const double p999 = percentile(latency, 0.999);
+
+	// Latencies in microseconds. loaded: while the ring is kept full, latency: one message in flight.
+	if (json)
+	{
+		printf("%s\n  {\"mode\": \"%s\", \"ring\": %zu, \"size\": %zu, \"wait\": \"%s\", \"messages\": %zu, \"lost\": %zu, "
+			"\"msgs_per_s\": %.0f, \"gb_per_s\": %.3f, \"loaded_p50_us\": %.2f, \"loaded_p99_us\": %.2f, "
+			"\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f}",
+			first ? "" : ",", modeNames[c.mode], c.ringSize, c.messageSize, waitNames[c.wait], loaded.size(), lost,
+			messagesPerSecond, gigabytesPerSecond, loadedP50, loadedP99, p50, p99, p999);
+	}
+	else
+	{
+		printf("%s,%zu,%zu,%s,%zu,%zu,%.0f,%.3f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+			modeNames[c.mode], c.ringSize, c.messageSize, waitNames[c.wait], loaded.size(), lost,
+			messagesPerSecond, gigabytesPerSecond, loadedP50, loadedP99, p50, p99, p999);
+	}
+
+	fflush(stdout);
+	return 0;
+}
+
+#if defined(_WIN32)
+typedef HANDLE Process;
+
+Process spawn(const std::string& args)
+{
+	char path[MAX_PATH];
+	GetModuleFileNameA(NULL, path, MAX_PATH);
+
+	std::string commandLine = "\"" + std::string(path) + "\" " + args;
+
+	// The children write to the same stdout, also when it is redirected to a file
+	STARTUPINFOA si = {};
+	si.cb = sizeof(si);
+	si.dwFlags = STARTF_USESTDHANDLES;
+	si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+	si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+	si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+	PROCESS_INFORMATION pi = {};
+
+	if (!CreateProcessA(NULL, &commandLine[0], NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi)) {
+		printf("Could not start process (%d).\n", GetLastError());
+		exit(0);
+	}
+
+	CloseHandle(pi.hThread);
+	return pi.hProcess;
+}
+
+int join(Process process)
+{
+	DWORD code = 1;
+
+	WaitForSingleObject(process, INFINITE);
+	GetExitCodeProcess(process, &code);
+	CloseHandle(process);
+
+	return (int)code;
+}
+#else
+typedef pid_t Process;
+
+std::string self;	// argv[0]
+
+Process spawn(const std::string& args)
+{
+	fflush(stdout);
+
+	const pid_t pid = fork();
+
+	if (pid == -1) {
+		printf("Could not start process (%d).\n", errno);
+		exit(0);
+	}
+
+	if (pid == 0)
+	{
+		// Split on spaces, none of the arguments contain one
+		std::vector<std::string> words = { self };
+		size_t start = 0;
+
+		while (start < args.size())
+		{
+			const size_t end = std::min(args.find(' ', start), args.size());
+			words.push_back(args.substr(start, end - start));
+			start = end + 1;
+		}
+
+		std::vector<char*> argv;
+
+		for (std::string& word : words)
+			argv.push_back(&word[0]);
+
+		argv.push_back(nullptr);
+
+		execv(self.c_str(), argv.data());
+		_exit(1);
+	}
+
+	return pid;
+}
+
+int join(Process process)
+{
+	int status = 0;
+	waitpid(process, &status, 0);
+
+	return (WIFEXITED(status)) ? WEXITSTATUS(status) : 1;
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+#if !defined(_WIN32)
+	self = argv[0];
+#endif
+
+	// Child processes: ComBench producer|consumer <secret> <case> [json first]
+	if (argc >= 9 && strcmp(argv[1], "producer") == 0)
+		return producer(argv[2], parseCase(argv + 3));
+
+	if (argc >= 11 && strcmp(argv[1], "consumer") == 0)
+		return consumer(argv[2], parseCase(argv + 3), atoi(argv[9]) != 0, atoi(argv[10]) != 0);
+
+	const bool json = (argc > 1 && strcmp(argv[1], "json") == 0);
+	const size_t budget = ((argc > 2) ? strtoull(argv[2], nullptr, 10) : 256) << 20;
+	const std::string onlyMode = (argc > 3) ? argv[3] : "";	// Run one mode or wait strategy instead of all
+	const std::string onlyWait = (argc > 4) ? argv[4] : "";
+
+	std::vector<Case> cases;
+
+	for (const ComLib::MODE mode : { ComLib::LOCKED, ComLib::SPSC, ComLib::BROADCAST, ComLib::MPSC })
+		for (const size_t ringSize : ringSizes)
+			for (const size_t messageSize : messageSizes)
+				for (const WAIT strategy : { SPIN, YIELD, SLEEP })
+				{
+					if ((!onlyMode.empty() && onlyMode != modeNames[mode]) || (!onlyWait.empty() && onlyWait != waitNames[strategy]))
+						continue;
+
+					Case c;
+					c.mode = mode;
+					c.ringSize = ringSize;
+					c.messageSize = messageSize;
+					c.wait = strategy;
+					c.count = std::max<size_t>(std::min<size_t>(budget / messageSize, BENCH_MAXMESSAGES), 16);
+					c.latencyCount = std::min<size_t>(c.count, BENCH_LATENCYMESSAGES);
+
+					cases.push_back(c);
+				}
+
+	if (json)
+		printf("[");
+	else
+		printf("mode,ring,size,wait,messages,lost,msgs_per_s,gb_per_s,loaded_p50_us,loaded_p99_us,p50_us,p99_us,p999_us\n");
+
+	fflush(stdout);
+
+	bool first = true;
+
+	for (size_t i = 0; i < cases.size(); i++)
+	{
+		const Case& c = cases[i];
+
+		// A fresh segment per case, so one case cannot leave messages or a stuck reader for the next
+		const std::string secret = "ComBench" + std::to_string(
+#if defined(_WIN32)
+			GetCurrentProcessId()
+#else
+			getpid()
+#endif
+		) + "_" + std::to_string(i);
+
+		fprintf(stderr, "[%zu/%zu] %s ring %zu size %zu %s\n", i + 1, cases.size(), modeNames[c.mode], c.ringSize, c.messageSize, waitNames[c.wait]);
+
+		// The consumer goes first, it has to join a BROADCAST segment before the producer sends anything
+		const Process consumerProcess = spawn("consumer " + caseArgs(secret, c) + " " + std::to_string(json) + " " + std::to_string(first));
+		const Process producerProcess = spawn("producer " + caseArgs(secret, c));
+
+		const int producerResult = join(producerProcess);
+		const int consumerResult = join(consumerProcess);
+
+		if (producerResult != 0 || consumerResult != 0)
+			fprintf(stderr, "Case failed (producer %d, consumer %d).\n", producerResult, consumerResult);
+		else
+			first = false;
+	}
+
+	if (json)
+		printf("\n]\n");
+
+	return 0;
+}
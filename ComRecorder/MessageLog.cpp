@@ -0,0 +1,225 @@
+#include "MessageLog.h"
+
+#define MESSAGELOG_MAGIC "MAYALOG8" // Ends in SCHEMA_VERSION, a log plays back only to renderers of its wire format
+
+#if defined(_WIN32)
+MessageLog::MessageLog(const std::string& path, const bool writing)
+	: hFileMap(NULL), path(path), writing(writing), mData(nullptr), mapSize(0), used(sizeof(FileHeader)), position(sizeof(FileHeader)), fh(nullptr)
+{
+	hFile = CreateFileA(
+		path.c_str(),
+		writing ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		writing ? CREATE_ALWAYS : OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+
+	if (hFile == INVALID_HANDLE_VALUE) {
+		printf("Could not open %s (%d).\n", path.c_str(), GetLastError());
+		exit(0);
+	}
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(hFile, &fileSize);
+
+	if (!writing && (size_t)fileSize.QuadPart < sizeof(FileHeader)) {
+		printf("%s is not a message log.\n", path.c_str());
+		exit(0);
+	}
+
+	map(writing ? MESSAGELOG_GROWTH : (size_t)fileSize.QuadPart);
+}
+
+void MessageLog::map(const size_t size)
+{
+	// A mapping larger than the file extends it
+	hFileMap = CreateFileMappingA(
+		hFile,
+		NULL,
+		writing ? PAGE_READWRITE : PAGE_READONLY,
+		(DWORD)((unsigned long long)size >> 32),
+		(DWORD)size,
+		NULL
+	);
+
+	if (hFileMap == nullptr) {
+		printf("Could not create file mapping object (%d).\n", GetLastError());
+		exit(0);
+	}
+
+	mData = static_cast<char*>(MapViewOfFile(hFileMap, writing ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0));
+
+	if (mData == nullptr) {
+		printf("Could not map view of file (%d).\n", GetLastError());
+		exit(0);
+	}
+
+	mapSize = size;
+	fh = reinterpret_cast<FileHeader*>(mData);
+}
+
+void MessageLog::unmap()
+{
+	UnmapViewOfFile((LPCVOID)mData);
+	CloseHandle(hFileMap);
+	mData = nullptr;
+}
+#else
+MessageLog::MessageLog(const std::string& path, const bool writing)
+	: path(path), writing(writing), mData(nullptr), mapSize(0), used(sizeof(FileHeader)), position(sizeof(FileHeader)), fh(nullptr)
+{
+	hFile = open(path.c_str(), writing ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0644);
+
+	if (hFile == -1) {
+		printf("Could not open %s (%d).\n", path.c_str(), errno);
+		exit(0);
+	}
+
+	struct stat st {};
+	fstat(hFile, &st);
+
+	if (!writing && (size_t)st.st_size < sizeof(FileHeader)) {
+		printf("%s is not a message log.\n", path.c_str());
+		exit(0);
+	}
+
+	map(writing ? MESSAGELOG_GROWTH : (size_t)st.st_size);
+}
+
+void MessageLog::map(const size_t size)
+{
+	if (writing && ftruncate(hFile, (off_t)size) == -1) {
+		printf("Could not size %s (%d).\n", path.c_str(), errno);
+		exit(0);
+	}
+
+	mData = static_cast<char*>(mmap(nullptr, size, writing ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, hFile, 0));
+
+	if (mData == MAP_FAILED) {
+		printf("Could not map %s (%d).\n", path.c_str(), errno);
+		exit(0);
+	}
+
+	mapSize = size;
+	fh = reinterpret_cast<FileHeader*>(mData);
+}
+
+void MessageLog::unmap()
+{
+	munmap(mData, mapSize);
+	mData = nullptr;
+}
+#endif
+
+char* MessageLog::append(const long long time, const unsigned int lane, const size_t length)
+{
+	const size_t total = sizeof(Record) + ((length + 7) & ~size_t(7));
+
+	// Remapped larger, the records written so far stay where they are in the file
+	if (used + total > mapSize)
+	{
+		const size_t size = mapSize + ((total > MESSAGELOG_GROWTH) ? total : MESSAGELOG_GROWTH);
+
+		unmap();
+		map(size);
+	}
+
+	Record* record = reinterpret_cast<Record*>(mData + used);
+	record->time = time;
+	record->length = length;
+	record->lane = lane;
+	record->pad = 0;
+
+	used += total;
+
+	// Kept current, so a recording cut short by a crash can still be read up to here
+	memcpy(fh->magic, MESSAGELOG_MAGIC, sizeof(fh->magic));
+	fh->records++;
+	fh->size = used;
+
+	return reinterpret_cast<char*>(record + 1);
+}
+
+const MessageLog::Record* MessageLog::next()
+{
+	if (memcmp(fh->magic, MESSAGELOG_MAGIC, sizeof(fh->magic)) != 0) {
+		printf("%s is not a message log, or one of another schema version.\n", path.c_str());
+		exit(0);
+	}
+
+	const size_t end = (fh->size < mapSize) ? (size_t)fh->size : mapSize;
+
+	if (position + sizeof(Record) > end)
+		return nullptr;
+
+	const Record* record = reinterpret_cast<const Record*>(mData + position);
+	const size_t room = end - position - sizeof(Record);
+
+	// A length the rest of the file cannot hold, the log was cut short or damaged. Nothing after it is read.
+	if (record->length > room || (((size_t)record->length + 7) & ~size_t(7)) > room) {
+		printf("%s has a bad record at byte %zu, the rest is skipped.\n", path.c_str(), position);
+		position = end;
+		return nullptr;
+	}
+
+	position += sizeof(Record) + (((size_t)record->length + 7) & ~size_t(7));
+
+	return record;
+}
+
+void MessageLog::rewind()
+{
+	position = sizeof(FileHeader);
+}
+
+size_t MessageLog::records() const
+{
+	return (size_t)fh->records;
+}
+
+size_t MessageLog::size() const
+{
+	return (size_t)fh->size;
+}
+
+#if defined(_WIN32)
+MessageLog::~MessageLog()
+{
+	if (fh->records == 0 && writing)
+	{
+		memcpy(fh->magic, MESSAGELOG_MAGIC, sizeof(fh->magic));
+		fh->size = used;
+	}
+
+	unmap();
+
+	if (writing)
+	{
+		LARGE_INTEGER end;
+		end.QuadPart = (LONGLONG)used;
+
+		SetFilePointerEx(hFile, end, NULL, FILE_BEGIN);
+		SetEndOfFile(hFile);
+	}
+
+	CloseHandle(hFile);
+}
+#else
+MessageLog::~MessageLog()
+{
+	if (fh->records == 0 && writing)
+	{
+		memcpy(fh->magic, MESSAGELOG_MAGIC, sizeof(fh->magic));
+		fh->size = used;
+	}
+
+	unmap();
+
+	if (writing && ftruncate(hFile, (off_t)used) == -1)
+		printf("Could not size %s (%d).\n", path.c_str(), errno);
+
+	close(hFile);
+}
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+// Same platform headers and windows.h flags as the ring
+#include "ComLib.h"
+
+// The file is grown by at least this much at a time
+#define MESSAGELOG_GROWTH (64 << 20)
+
+// Append-only file of timestamped messages, memory-mapped for writing and reading.
+// Records are packed back-to-back, each message padded to 8 bytes so it can be read in place.
+class MessageLog
+{
+public:
+	// Precedes every message in the file
+	struct Record
+	{
+		long long time = 0;					// ns since the recording started
+		unsigned long long length = 0;		// Of the message that follows
+		unsigned int lane = 0;
+		unsigned int pad = 0;
+	};
+
+private:
+	struct FileHeader
+	{
+		char magic[8];						// MESSAGELOG_MAGIC
+		unsigned long long records = 0;
+		unsigned long long size = 0;		// Bytes used, header included
+	};
+
+#if defined(_WIN32)
+	HANDLE hFile;
+	HANDLE hFileMap;
+#else
+	int hFile;
+#endif
+	std::string path;
+	bool writing;
+	char* mData;
+	size_t mapSize;
+	size_t used;		// Writer: end of the last record
+	size_t position;	// Reader: start of the next record
+
+	FileHeader* fh;
+
+	void map(const size_t size);
+	void unmap();
+
+public:
+	// writing: create path, replacing any file there. Otherwise open it for reading.
+	MessageLog(const std::string& path, const bool writing);
+
+	// Writer: room for a message of length bytes at the end of the log, valid until the next append
+	char* append(const long long time, const unsigned int lane, const size_t length);
+
+	// Reader: the next record, its message follows it. nullptr at the end of the log.
+	const Record* next();
+	void rewind();
+
+	size_t records() const;
+	size_t size() const;
+
+	// Writer: the file is cut down to what was used
+	~MessageLog();
+};
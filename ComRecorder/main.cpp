@@ -0,0 +1,295 @@
+// Records the Maya to renderer message stream to a file and plays it back to a renderer without Maya
+// Usage: ComRecorder record <file> [seconds]
+//        ComRecorder replay <file> [timed|fast] [loops]
+// Recording attaches as one more renderer. Meshes are stored with their vertex arrays inline and camera and
+// transform slots as UPDATE messages, so a log plays back through the transport alone.
+// Like a renderer it says hello with nothing in it, so a recording started mid-session begins with the whole scene.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <csignal>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "MessageStructure.h"
+#include "MessageLog.h"
+
+// How long replay waits for the renderer to read the end of the log before leaving
+#define REPLAY_DRAIN_MS 10000
+
+volatile std::sig_atomic_t running = 1;
+
+void stop(int)
+{
+	running = 0;
+}
+
+long long elapsed(const std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A camera or transform slot as the message the renderer applies to its own table
+template <NODETYPE Type>
+void recordState(MessageLog& log, const long long time, const NodeHandle node, const typename MessageLayout<Type, UPDATE>::Fixed& value)
+{
+	const size_t size = MessageLayout<Type, UPDATE>::size(value);
+
+	encodeMessage<Type, UPDATE>(log.append(time, LANE_INTERACTIVE, size), size, node, sUuid{}, value);
+}
+
+// A mesh whose arrays are in the blob heap, logged with them inline. The heap is gone once the plugin frees the blob.
+// False if the message is not one of those. One whose blob is not in the heap is left out, a replay could not read it.
+template <ACTIVITY Activity>
+bool recordMesh(MessageLog& log, const long long time, const unsigned int lane, const char* data, const size_t length)
+{
+	MessageView<MESH, Activity> message;
+
+	if (!decodeMessage(data, length, message) || message.fixed.blob.length == 0)
+		return false;
+
+	const char* arrays = comlib.shared() ? blobHeap.data(message.fixed.blob, meshArraysSize(message.fixed)) : nullptr;
+
+	if (arrays == nullptr)
+	{
+		printf("Mesh %u points outside the blob heap, not recorded.\n", message.header.node);
+		return true;
+	}
+
+	sMeshHeader meshHeader = message.fixed;
+	meshHeader.blob = BlobHandle();
+
+	const size_t size = MessageLayout<MESH, Activity>::size(meshHeader);
+
+	encodeMessage<MESH, Activity>(log.append(time, lane, size), size, message.header.node, message.uuid, meshHeader, arrays);
+
+	return true;
+}
+
+int record(const std::string& path, const double seconds)
+{
+	MessageLog log(path, true);
+
+	std::vector<NodeHandle> transformHandle;	// Transforms whose slots are followed, as in the renderer
+	std::vector<int> transformSlot;
+	std::vector<unsigned int> transformSequence;
+	int cameraSlot = -1;
+	unsigned int cameraSequence = 0;
+
+	const unsigned int recorderID = std::random_device{}();
+	unsigned int joins = 0;
+	int bulkRead = 0;
+	auto lastFeedback = std::chrono::steady_clock::now();
+
+	// Transforms added and removed by a message or a record of a PACKET
+	auto follow = [&](const sHeader& msgHead)
+	{
+		// Added again by a new plugin session it is followed under its new handle, the old one stays until removed
+		if (msgHead.type == TRANSFORM && msgHead.activity == ADD &&
+			std::find(transformHandle.begin(), transformHandle.end(), msgHead.node) == transformHandle.end())
+		{
+			transformHandle.push_back(msgHead.node);
+			transformSlot.push_back(-1);
+			transformSequence.push_back(0);
+		}
+
+		if (msgHead.type == TRANSFORM && msgHead.activity == REMOVE)
+		{
+			for (size_t i = 0; i < transformHandle.size(); i++)
+			{
+				if (transformHandle[i] == msgHead.node)
+				{
+					transformHandle.erase(transformHandle.begin() + i);
+					transformSlot.erase(transformSlot.begin() + i);
+					transformSequence.erase(transformSequence.begin() + i);
+					break;
+				}
+			}
+		}
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+	auto lastReport = start;
+
+	printf("Recording to %s, Ctrl+C to stop.\n", path.c_str());
+
+	while (running && (seconds <= 0.0 || elapsed(start) < seconds * 1e9))
+	{
+		size_t length = 0;
+		unsigned int lane = 0;
+		const char* data = nullptr;
+		size_t count = 0;
+
+		while ((data = comlib.peek(length, &lane)) != nullptr)
+		{
+			const long long time = elapsed(start);
+
+			sHeader msgHead{};
+			memcpy(&msgHead, data, sizeof(sHeader));
+
+			// Everything else is logged as it is, deltas are always inline
+			if (!recordMesh<ADD>(log, time, lane, data, length) && !recordMesh<UPDATE>(log, time, lane, data, length))
+				memcpy(log.append(time, lane, length), data, length);
+
+			// Packets are logged as they are, only their records are looked into
+			if (msgHead.activity == PACKET)
+			{
+				PacketReader packet(data, length);
+
+				const char* record = nullptr;
+				size_t recordSize = 0;
+
+				while (packet.next(record, recordSize))
+				{
+					sHeader recordHead{};
+					memcpy(&recordHead, record, sizeof(sHeader));
+
+					follow(recordHead);
+				}
+			}
+			else
+			{
+				follow(msgHead);
+			}
+
+			if (lane == LANE_BULK)
+				bulkRead++;
+
+			comlib.release();
+			count++;
+		}
+
+		// Hello and acks as a renderer sends them, see sFeedback
+		if (comlib.joins() != joins)
+		{
+			if (sendFeedback(HELLO, recorderID, FEEDBACK_WINDOW, {}))
+			{
+				joins = comlib.joins();
+				bulkRead = 0;
+				lastFeedback = std::chrono::steady_clock::now();
+			}
+		}
+		else if ((bulkRead > 0 || std::chrono::steady_clock::now() - lastFeedback > std::chrono::milliseconds(FEEDBACK_KEEPALIVE_MS)) &&
+			sendFeedback(ACK, recorderID, bulkRead, {}))
+		{
+			bulkRead = 0;
+			lastFeedback = std::chrono::steady_clock::now();
+		}
+
+		// Slots that changed since they were last looked at
+		const long long time = elapsed(start);
+
+		sCamera stateCam{};
+
+		if (cameraSlot < 0)
+			cameraSlot = stateTable.find(STATE_CAMERA);
+
+		if (stateTable.read(cameraSlot, STATE_CAMERA, &stateCam, sizeof(sCamera), cameraSequence))
+			recordState<CAMERA>(log, time, NODE_NONE, stateCam);
+
+		for (size_t i = 0; i < transformHandle.size(); i++)
+		{
+			if (transformSlot[i] < 0)
+				transformSlot[i] = stateTable.find(transformHandle[i]);
+
+			sTransform stateTransform{};
+
+			if (stateTable.read(transformSlot[i], transformHandle[i], &stateTransform, sizeof(sTransform), transformSequence[i]))
+				recordState<TRANSFORM>(log, time, transformHandle[i], stateTransform);
+		}
+
+		if (std::chrono::steady_clock::now() - lastReport > std::chrono::seconds(1))
+		{
+			printf("%zu messages, %.1f MB\n", log.records(), log.size() / double(1 << 20));
+			lastReport = std::chrono::steady_clock::now();
+		}
+
+		if (count == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	printf("Recorded %zu messages, %.1f MB in %.1f s.\n", log.records(), log.size() / double(1 << 20), elapsed(start) / 1e9);
+
+	return 0;
+}
+
+int replay(const std::string& path, const bool timed, const int loops)
+{
+	MessageLog log(path, false);
+
+	size_t messages = 0;
+	size_t bytes = 0;
+	size_t retries = 0;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for (int loop = 0; running && (loops <= 0 || loop < loops); loop++)
+	{
+		const auto loopStart = std::chrono::steady_clock::now();
+		const MessageLog::Record* record = nullptr;
+
+		log.rewind();
+
+		while (running && (record = log.next()) != nullptr)
+		{
+			// Original timing: wait for the moment the message was recorded at
+			if (timed)
+				std::this_thread::sleep_until(loopStart + std::chrono::nanoseconds(record->time));
+
+			const char* data = reinterpret_cast<const char*>(record + 1);
+
+			// Full ring: the renderer is behind, wait for it instead of losing the message
+			while (running && !comlib.send(data, (size_t)record->length, record->lane))
+			{
+				retries++;
+				comlib.flush();
+				std::this_thread::yield();
+			}
+
+			messages++;
+			bytes += (size_t)record->length;
+		}
+	}
+
+	const double seconds = elapsed(start) / 1e9;
+
+	printf("Replayed %zu messages, %.1f MB in %.2f s: %.0f msgs/s, %.1f MB/s, %zu retries on a full ring.\n",
+		messages, bytes / double(1 << 20), seconds, messages / seconds, bytes / double(1 << 20) / seconds, retries);
+
+	// On POSIX the last process to leave removes the segment, a socket needs its queue written out
+	const auto drainStart = std::chrono::steady_clock::now();
+
+	while (running && elapsed(drainStart) < REPLAY_DRAIN_MS * 1000000ll &&
+		(comlib.consumed(LANE_INTERACTIVE) != comlib.written(LANE_INTERACTIVE) || comlib.consumed(LANE_BULK) != comlib.written(LANE_BULK)))
+	{
+		comlib.flush();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3 || (strcmp(argv[1], "record") != 0 && strcmp(argv[1], "replay") != 0))
+	{
+		printf("Usage: ComRecorder record <file> [seconds]\n");
+		printf("       ComRecorder replay <file> [timed|fast] [loops]\n");
+		return 1;
+	}
+
+	// Ctrl+C leaves through the destructors, so the log is cut to size
+	std::signal(SIGINT, stop);
+
+	if (strcmp(argv[1], "record") == 0)
+		return record(argv[2], (argc > 3) ? atof(argv[3]) : 0.0);
+
+	return replay(argv[2], argc <= 3 || strcmp(argv[3], "fast") != 0, (argc > 4) ? atoi(argv[4]) : 1);
+}
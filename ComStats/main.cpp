@@ -0,0 +1,94 @@
+// Live view of the ComLib counters of a running segment
+// Usage: ComStats [secret] [interval ms]
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+#include "ComLib.h"
+
+volatile std::sig_atomic_t running = 1;
+
+void stop(int)
+{
+	running = 0;
+}
+
+int main(int argc, char* argv[])
+{
+	const std::string secret = (argc > 1) ? argv[1] : "MayaToRender";
+	const int interval = (argc > 2) ? atoi(argv[2]) : 1000;
+
+	// Attaching to a segment that does not exist would create one, with the wrong mode
+	while (running && !ComLib::exists(secret))
+	{
+		std::cout << "Waiting for " << secret << "..." << std::endl;
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+
+	if (!running)
+		return 0;
+
+	// Ctrl+C leaves through the destructor, so the segment is not kept alive by this process
+	std::signal(SIGINT, stop);
+
+	// Only reads counters, never sends or receives, so it takes no reader slot
+	ComLib comlib(secret, 1);
+
+	const char* modes[] = { "LOCKED", "SPSC", "BROADCAST", "MPSC" };
+
+	ComLib::Stats last = comlib.stats();
+	auto lastTime = std::chrono::steady_clock::now();
+
+	while (running)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+
+		// Follows the segment when the producer resizes it
+		comlib.refresh();
+
+		const ComLib::Stats now = comlib.stats();
+		const auto nowTime = std::chrono::steady_clock::now();
+		const double seconds = std::chrono::duration<double>(nowTime - lastTime).count();
+
+		// Counters are carried over on a resize, except for what readers of the old segment received after it
+		if (now.generation != last.generation)
+			last = now;
+
+		printf("\n%s  %s  generation %u  %.1f MB/lane  readers %u  dropped %llu  lock waits %llu (%.2f ms, %llu timeouts)\n",
+			secret.c_str(), modes[now.mode], now.generation, now.lanes[0].capacity / double(1 << 20), now.readers, now.readersDropped,
+			now.lockWaits, now.lockWaitNs / 1e6, now.lockTimeouts);
+
+		printf("lane     sent/s     MB/s   recv/s     MB/s      sent  failed  frags  wraps  stall ms   used %%  peak %%\n");
+
+		for (unsigned int i = 0; i < now.laneCount; i++)
+		{
+			const ComLib::LaneStats& l = now.lanes[i];
+			const ComLib::LaneStats& p = last.lanes[i];
+
+			printf("%4u %10.0f %8.2f %8.0f %8.2f %9llu %7llu %6llu %6llu %9.2f %7.1f %7.1f\n",
+				i,
+				(l.sent - p.sent) / seconds,
+				(l.sentBytes - p.sentBytes) / seconds / (1 << 20),
+				(l.received - p.received) / seconds,
+				(l.receivedBytes - p.receivedBytes) / seconds / (1 << 20),
+				l.sent,
+				l.failedSends,
+				l.fragments,
+				l.wraps,
+				l.sendStallNs / 1e6,
+				100.0 * l.occupancy / l.capacity,
+				100.0 * l.highWater / l.capacity);
+		}
+
+		last = now;
+		lastTime = nowTime;
+	}
+
+	return 0;
+}
@@ -1,13 +1,36 @@
 ﻿#include "maya_includes.h"
 #include "MessageStructure.h"
 #include <maya/MTimer.h>
+#include <maya/MTimerMessage.h>
+#include <maya/MUuid.h>
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 #include <vector>
 #include <queue>
+#include <unordered_map>
+
+#define SDEFL_IMPLEMENTATION
+#include "../raylib/src/external/sdefl.h" // DEFLATE compressor vendored by raylib, renderers inflate with its sinfl
 
 #define PLUGINNAME "[MayaApi] - "
 
+// Meshes with this many vertices or more are sent as VERTEX_QUANTIZED, if every vertex decodes within the tolerances
+#define QUANTIZE_VERTICES 1024
+#define QUANTIZE_POSITION_TOLERANCE 0.001f // Scene units, about 130 units of mesh extent at 16 bits
+#define QUANTIZE_UV_TOLERANCE 0.0005f // Half a texel of a 1k texture
+#define QUANTIZE_NORMAL_TOLERANCE 0.9999f // Least dot product of a normal and its decoded one, about 0.8 degrees
+
+// Inline mesh arrays of this size or more are compressed, as long as it pays off
+#define COMPRESS_SIZE 64<<10 // 64 KB
+#define COMPRESS_LEVEL 1 // sdefl level, 0 to 8. Low levels look for fewer matches and are much faster
+#define COMPRESS_RATIO 0.8 // Compressed arrays larger than this part of the raw ones are sent raw
+#define COMPRESS_RATE 8.0 // MB taken off messages per second of compressing, about what a 100 Mbit link moves. Below it sending raw is faster
+#define COMPRESS_BACKOFF 16 // Meshes sent raw without trying after compression did not pay off
+
+// Unchanged vertices a DELTA range runs on through rather than starting another, fewer and larger buffer updates for the renderer
+#define DELTA_GAP 4
+
 MCallbackId callbackId;
 MCallbackIdArray callbackIdArray;
 MStatus status = MS::kSuccess;
@@ -17,6 +40,78 @@ MTimer gTimer;
 // keep track of created meshes to maintain them
 std::queue<MObject> addedNodeList;
 
+// Messages that can't be written in place in the shared buffer are built here instead
+std::vector<char> msgStaging;
+std::queue<std::pair<size_t, BlobHandle>> blobsInFlight; // Blobs sent and the comlib position they were sent at
+
+// Mesh arrays are compressed from meshStaging into meshCompressed, see compressMeshArrays
+sdefl deflater;
+std::vector<char> meshStaging;
+std::vector<char> meshCompressed;
+int compressBackoff = 0; // Meshes left to send raw before compression is tried again
+
+// Small messages of the current callback burst, one PACKET per lane that flushPackets sends (see sPacket)
+std::vector<char> packets[2];
+int packetRecords[2] = {};
+
+// Renderers that replied and the bulk messages each can still take, see sFeedback
+struct RendererCredits
+{
+	unsigned int renderer;
+	int credits;
+	std::chrono::steady_clock::time_point lastSeen;
+};
+
+std::vector<RendererCredits> renderers;
+std::vector<NodeHandle> deferredMeshes; // Meshes whose update is held back until every renderer has credits again
+bool stateSlotsWarned = false; // Warned that stateTable is full, again once a transform remove frees a slot
+
+// Handles given out so far (see NodeHandle), by the uuid's bytes and back. nodeUuids[0] is NODE_NONE.
+std::unordered_map<std::string, NodeHandle> nodeHandles;
+std::vector<sUuid> nodeUuids(1);
+
+// Vertex arrays and triangles of a mesh as they are sent, see sMeshHeader
+struct MeshArrays
+{
+	MFloatArray posArr;	// Vertex positions
+	MFloatArray uvArr;	// Vertex uvs
+	MFloatArray norArr;	// Vertex normals
+	std::vector<unsigned int> indices; // 3 per triangle
+	std::vector<int> points;	// Maya vertex of each vertex
+	std::vector<int> normalIds;	// Normal id of each vertex
+
+	// The same vertices as VERTEX_QUANTIZED, empty if they are sent as floats (quantizeMeshArrays)
+	std::vector<unsigned short> posQuantized;
+	std::vector<unsigned short> uvHalf;
+	std::vector<unsigned short> norOctahedral;
+	float boundsMin[3] = {};
+	float boundsMax[3] = {};
+};
+
+// A mesh as it was last sent whole, for the DELTA of an update that keeps its layout (meshLayout)
+struct SentMesh
+{
+	unsigned long long layout;
+	NodeHandle material;
+	VERTEXFORMAT format;
+	float boundsMin[3];
+	float boundsMax[3];
+	std::vector<int> points;	// As in MeshArrays
+	std::vector<int> normalIds;
+	std::vector<float> positions;	// As sent, before quantization
+	std::vector<float> normals;
+};
+
+std::unordered_map<NodeHandle, SentMesh> sentMeshes;
+
+// A Maya vertex as it is used by a face corner, the vertices sent are one per distinct corner
+struct MeshCorner
+{
+	int normal;		// Normal id
+	int uv;			// Uv id, -1 without uvs
+	int previous;	// Vertex sent before it for the same Maya vertex, -1 if none
+};
+
 // Maya command once
 // commandPort -n ":1234"
 
@@ -32,6 +127,7 @@ void addCallbacks();
 void nodeAdded(MObject& node, void* clientData);
 void nodeRemoved(MObject& node, void* clientData);
 void cameraUpdate(const MString& modelPanel, void* clientData);
+void flushCallback(float elapsedTime, float lastTime, void* clientData);
 
 // TODO: merge Add/Update/Remove. They dont differ much and can be the same function
 // 
@@ -41,6 +137,19 @@ void cameraUpdate(const MString& modelPanel, void* clientData);
 
 void meshAdd(MObject& node);
 void meshUpdate(MObject& node);
+template <ACTIVITY Activity> void meshSendWhole(MObject& node, MFnMesh& mesh);
+void getMeshArrays(MObject& node, MeshArrays& arrays);
+bool quantizeMeshArrays(MeshArrays& arrays);
+bool quantizeVertex(const float position[3], const float normal[3], const float boundsMin[3], const float boundsMax[3], unsigned short posQuantized[4], unsigned short norOctahedral[2]);
+unsigned short floatToHalf(float value);
+float halfToFloat(unsigned short half);
+void writeMeshArrays(char* data, const MeshArrays& arrays, const sMeshHeader& header);
+bool compressMeshArrays(const MeshArrays& arrays, sMeshHeader& header);
+template <ACTIVITY Activity> bool sendMesh(NodeHandle handle, const MeshArrays& arrays, sMeshHeader& header);
+unsigned long long meshLayout(MFnMesh& mesh);
+void rememberMesh(NodeHandle handle, const MeshArrays& arrays, const sMeshHeader& header, unsigned long long layout, bool sent);
+bool meshDelta(MObject& node);
+NodeHandle meshMaterial(MObject& node);
 void meshRemove(MObject& node);
 
 void materialAdd(MObject& node);
@@ -68,6 +177,32 @@ void attributeCallbackInfo(MNodeMessage::AttributeMessage msg, MPlug& plug, MPlu
 void updateCamera();
 void appendCallback(MString name, MCallbackId* id, MStatus* status);
 
+char* beginMessage(size_t size);
+bool endMessage(char* data, size_t size);
+BlobHandle beginBlob(size_t size);
+void endBlob(const BlobHandle& blob, bool sent);
+template <NODETYPE Type, ACTIVITY Activity> size_t writeMessage(char* data, size_t capacity, NodeHandle node, const typename MessageLayout<Type, Activity>::Fixed& fixed, const void* variable = nullptr);
+template <NODETYPE Type> void writeState(NodeHandle node, const typename MessageLayout<Type, UPDATE>::Fixed& value);
+bool sendBulk(const char* data, size_t size);
+void sendRemove(NODETYPE type, NodeHandle node);
+char* beginRecord(LANE lane, size_t size);
+bool flushPacket(LANE lane);
+void flushPackets();
+
+void readFeedback();
+void resyncScene(const sNodeRef* nodes, int nodeCount);
+void resyncNode(const sNodeRef& node);
+void resendPair(MObject& transform, MObject& mesh);
+sUuid uuidOf(const MObject& node);
+NodeHandle handleOf(const sUuid& uuid);
+NodeHandle handleOf(const MObject& node);
+bool findNode(NodeHandle handle, MObject& node);
+MObject meshOf(MObject& transform);
+MObject materialOf(MObject& shadingEngine);
+bool bulkCredit();
+void spendCredit();
+void queueMeshUpdate(MObject& node);
+
 void nodeAdded(MObject& node, void* clientData)
 {
 	MString str = PLUGINNAME;
@@ -137,259 +272,691 @@ void meshAdd(MObject& node)
 
 	if (status == MStatus::kSuccess)
 	{
-		// Fetch data from mesh	
-		int numPoints = 0;
-		int numTriangles = 0;
-		char materialID[37]{};
+		// Send materials used by mesh
+		MItDependencyGraph itSE(node, MFn::kShadingEngine, MItDependencyGraph::kDownstream, MItDependencyGraph::kDepthFirst, MItDependencyGraph::kNodeLevel);
+		for (; !itSE.isDone(); itSE.next())
+		{
+			materialAdd(itSE.currentItem());
+		}
 
-		MFloatArray posArr; // Vertex positions
-		MFloatArray uvArr;	// Vertex uvs
-		MFloatArray norArr; // Vertex normals
+		meshSendWhole<ADD>(node, mesh);
+	}
+}
 
-		MItMeshPolygon polyIter(node);
+void meshUpdate(MObject& node)
+{
+	MFnMesh mesh(node, &status);
 
-		// Iterate each face
-		for (; !polyIter.isDone(); polyIter.next())
-		{
+	// Vertices moved and nothing else, only they are sent
+	if (status == MStatus::kSuccess && meshDelta(node))
+		return;
 
-			// Get the number of tris per face
-			int currentNumTris = 0;
-			polyIter.numTriangles(currentNumTris);
-			numTriangles += currentNumTris;
+	if (status == MStatus::kSuccess)
+	{
+		meshSendWhole<UPDATE>(node, mesh);
 
-			// Get vertex position and vertex id from all trinagles per face 
-			MPointArray points;
-			MIntArray vertexList;
-			polyIter.getTriangles(points, vertexList);
-			numPoints += points.length();
+		//MItDependencyGraph itSE(node, MFn::kShadingEngine, MItDependencyGraph::kDownstream, MItDependencyGraph::kDepthFirst, MItDependencyGraph::kNodeLevel);
+		//for (; !itSE.isDone(); itSE.next())
+		//{
+		//	materialUpdate(itSE.currentItem());
+		//}
+	}
+}
 
-			// Iterate through each point of all trinagles per face (3 * 2)
-			for (size_t i = 0; i < points.length(); i++)
-			{
-				posArr.append(points[i].x);
-				posArr.append(points[i].y);
-				posArr.append(points[i].z);
-
-				// Get vertex UVs
-				float2 uvPoint;
-				polyIter.getUVAtPoint(points[i], uvPoint);
-				uvArr.append(uvPoint[0]);
-				uvArr.append(1.0 - uvPoint[1]);
-
-				// Get vertex normals
-				MVector normalPoint;
-				polyIter.getNormal(normalPoint);
-				norArr.append(normalPoint.x);
-				norArr.append(normalPoint.y);
-				norArr.append(normalPoint.z);
+// Whole mesh as an add or an update, remembered for the vertex deltas that follow
+template <ACTIVITY Activity>
+void meshSendWhole(MObject& node, MFnMesh& mesh)
+{
+	// Fetch data from mesh	
+	MeshArrays meshArrays;
+	getMeshArrays(node, meshArrays);
+
+	// Message data
+	sMeshHeader meshHeader{};
+	meshHeader.vertexCount = meshArrays.posArr.length() / 3;
+	meshHeader.triangleCount = (int)meshArrays.indices.size() / 3;
+	meshHeader.indexSize = (meshHeader.vertexCount <= SHORTINDEX_VERTICES) ? sizeof(unsigned short) : sizeof(unsigned int);
+	meshHeader.material = meshMaterial(node);
+	meshHeader.format = (meshHeader.vertexCount >= QUANTIZE_VERTICES && quantizeMeshArrays(meshArrays)) ? VERTEX_QUANTIZED : VERTEX_FLOAT;
+
+	std::memcpy(meshHeader.boundsMin, meshArrays.boundsMin, sizeof(meshHeader.boundsMin));
+	std::memcpy(meshHeader.boundsMax, meshArrays.boundsMax, sizeof(meshHeader.boundsMax));
+
+	// Message send
+	const bool sent = sendMesh<Activity>(handleOf(node), meshArrays, meshHeader);
+	rememberMesh(handleOf(node), meshArrays, meshHeader, meshLayout(mesh), sent);
+}
 
+// Material of the shading engine a mesh is connected to, NODE_NONE if it has none
+NodeHandle meshMaterial(MObject& node)
+{
+	NodeHandle material = NODE_NONE;
+
+	MItDependencyGraph itSE(node, MFn::kShadingEngine, MItDependencyGraph::kDownstream, MItDependencyGraph::kDepthFirst, MItDependencyGraph::kNodeLevel);
+	for (; !itSE.isDone(); itSE.next())
+	{
+		MFnDependencyNode shadingEngine(itSE.currentItem());
+		MPlug surfaceShader = shadingEngine.findPlug("surfaceShader", &status);
+		if (status == MS::kSuccess)
+		{
+			MPlugArray plugArr;
+			surfaceShader.connectedTo(plugArr, true, false);
+			if (plugArr.length())
+			{
+				material = handleOf(plugArr[0].node());
 			}
 		}
+	}
 
-		// Get connected mat uuid
-		MItDependencyGraph itSE(node, MFn::kShadingEngine, MItDependencyGraph::kDownstream, MItDependencyGraph::kDepthFirst, MItDependencyGraph::kNodeLevel);
-		for (; !itSE.isDone(); itSE.next())
+	return material;
+}
+
+// Vertices and triangles of a mesh from whole-mesh arrays, each Maya call once rather than per face
+void getMeshArrays(MObject& node, MeshArrays& arrays)
+{
+	MFnMesh mesh(node);
+
+	MPointArray points;
+	mesh.getPoints(points);
+
+	MFloatVectorArray normals;
+	mesh.getNormals(normals);
+
+	MFloatArray uArr;
+	MFloatArray vArr;
+	mesh.getUVs(uArr, vArr);
+
+	// Maya vertex, normal id and uv id of every face vertex, face after face
+	MIntArray faceCounts;
+	MIntArray faceVertices;
+	mesh.getVertices(faceCounts, faceVertices);
+
+	MIntArray normalCounts;
+	MIntArray faceNormals;
+	mesh.getNormalIds(normalCounts, faceNormals);
+
+	MIntArray uvCounts;
+	MIntArray uvIds;
+	mesh.getAssignedUVs(uvCounts, uvIds);
+
+	// Face vertices of the triangles
+	MIntArray triangleCounts;
+	MIntArray triangleVertices;
+	mesh.getTriangleOffsets(triangleCounts, triangleVertices);
+
+	const unsigned int faceVertexCount = faceVertices.length();
+	const unsigned int indexCount = triangleVertices.length();
+
+	// Only faces with uvs have theirs in uvIds
+	std::vector<int> faceUvs(faceVertexCount, -1);
+	unsigned int faceFirst = 0;
+	unsigned int uvFirst = 0;
+
+	for (unsigned int f = 0; f < faceCounts.length(); f++)
+	{
+		if (uvCounts[f] == faceCounts[f])
 		{
-			materialAdd(itSE.currentItem()); // Send material used by mesh
+			for (int c = 0; c < faceCounts[f]; c++)
+				faceUvs[faceFirst + c] = uvIds[uvFirst + c];
+		}
 
-			MFnDependencyNode shadingEngine(itSE.currentItem());
-			MPlug surfaceShader = shadingEngine.findPlug("surfaceShader", &status);
-			if (status == MS::kSuccess)
+		faceFirst += faceCounts[f];
+		uvFirst += uvCounts[f];
+	}
+
+	// Vertex sent for each face vertex, -1 until a triangle uses it.
+	// Corners of the same Maya vertex are chained from the last one sent, a corner with the same normal and uv shares the vertex.
+	std::vector<int> faceIndices(faceVertexCount, -1);
+	std::vector<int> lastCorner(points.length(), -1);
+	std::vector<MeshCorner> corners;
+
+	corners.reserve(faceVertexCount);
+	arrays.points.reserve(faceVertexCount);
+	arrays.normalIds.reserve(faceVertexCount);
+	arrays.indices.resize(indexCount);
+
+	for (unsigned int i = 0; i < indexCount; i++)
+	{
+		int& index = faceIndices[triangleVertices[i]];
+
+		if (index < 0)
+		{
+			const int vertex = faceVertices[triangleVertices[i]];
+			const int normal = faceNormals[triangleVertices[i]];
+			const int uv = faceUvs[triangleVertices[i]];
+
+			index = lastCorner[vertex];
+
+			while (index >= 0 && (corners[index].normal != normal || corners[index].uv != uv))
+				index = corners[index].previous;
+
+			if (index < 0)
 			{
-				MPlugArray plugArr;
-				surfaceShader.connectedTo(plugArr, true, false);
-				if (plugArr.length())
-				{
-					MFnDependencyNode mat(plugArr[0].node());
-					std::memcpy(materialID, mat.uuid().asString().asChar(), 37);
-				}
+				index = (int)corners.size();
+				corners.push_back({ normal, uv, lastCorner[vertex] });
+				lastCorner[vertex] = index;
+
+				arrays.points.push_back(vertex);
+				arrays.normalIds.push_back(normal);
 			}
 		}
 
-		// Message data
-		sHeader mainHeader;
-		mainHeader.activity = ADD;
-		mainHeader.type = MESH;
-		std::memcpy(mainHeader.nodeID, mesh.uuid().asString().asChar(), 37);
+		arrays.indices[i] = index;
+	}
 
-		sMeshHeader meshHeader;
-		meshHeader.vertexCount = numPoints;
-		meshHeader.triangleCount = numTriangles;
-		std::memcpy(meshHeader.connectedMatID, materialID, 37);
+	// Vertex arrays at their final length, filled in place
+	const unsigned int vertexCount = (unsigned int)corners.size();
 
-		sMeshData meshData;
-		meshData.posXYZ = new float[posArr.length()];
-		posArr.get(meshData.posXYZ);
-		meshData.UV = new float[uvArr.length()];
-		uvArr.get(meshData.UV);
-		meshData.norXYZ = new float[norArr.length()];
-		norArr.get(meshData.norXYZ);
+	arrays.posArr.setLength(vertexCount * 3);
+	arrays.uvArr.setLength(vertexCount * 2);
+	arrays.norArr.setLength(vertexCount * 3);
 
-		// Message send
-		msgSize = 0;
-		msgSize += sizeof(sHeader);
-		msgSize += sizeof(sMeshHeader);
+	for (unsigned int v = 0; v < vertexCount; v++)
+	{
+		const MPoint& point = points[arrays.points[v]];
+		const MFloatVector& normal = normals[corners[v].normal];
+		const int uv = corners[v].uv;
 
-		msgSize += sizeof(float) * posArr.length();
-		msgSize += sizeof(float) * uvArr.length();
-		msgSize += sizeof(float) * norArr.length();
+		arrays.posArr[v * 3 + 0] = (float)point.x;
+		arrays.posArr[v * 3 + 1] = (float)point.y;
+		arrays.posArr[v * 3 + 2] = (float)point.z;
 
-		int offset = 0;
+		arrays.uvArr[v * 2 + 0] = (uv >= 0) ? uArr[uv] : 0.0f;
+		arrays.uvArr[v * 2 + 1] = (uv >= 0) ? 1.0f - vArr[uv] : 1.0f;
 
-		std::memcpy((char*)msg, &mainHeader, sizeof(sHeader));
-		offset += sizeof(sHeader);
+		arrays.norArr[v * 3 + 0] = normal.x;
+		arrays.norArr[v * 3 + 1] = normal.y;
+		arrays.norArr[v * 3 + 2] = normal.z;
+	}
+}
 
-		std::memcpy((char*)msg + offset, &meshHeader, sizeof(sMeshHeader));
-		offset += sizeof(sMeshHeader);
+// Fills the VERTEX_QUANTIZED arrays and decodes them as the renderer's vertex shader does.
+// False with the arrays left empty if a vertex comes back further from its floats than the tolerances allow.
+bool quantizeMeshArrays(MeshArrays& arrays)
+{
+	const unsigned int vertexCount = arrays.posArr.length() / 3;
 
-		std::memcpy((char*)msg + offset, meshData.posXYZ, sizeof(float) * posArr.length());
-		offset += sizeof(float) * posArr.length();
+	for (int axis = 0; axis < 3; axis++)
+	{
+		arrays.boundsMin[axis] = (vertexCount > 0) ? arrays.posArr[axis] : 0.0f;
+		arrays.boundsMax[axis] = arrays.boundsMin[axis];
+	}
 
-		std::memcpy((char*)msg + offset, meshData.UV, sizeof(float) * uvArr.length());
-		offset += sizeof(float) * uvArr.length();
+	for (unsigned int v = 0; v < vertexCount; v++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			arrays.boundsMin[axis] = std::min(arrays.boundsMin[axis], arrays.posArr[v * 3 + axis]);
+			arrays.boundsMax[axis] = std::max(arrays.boundsMax[axis], arrays.posArr[v * 3 + axis]);
+		}
+	}
+
+	arrays.posQuantized.resize(vertexCount * 4);
+	arrays.uvHalf.resize(vertexCount * 2);
+	arrays.norOctahedral.resize(vertexCount * 2);
+
+	bool fits = true;
+
+	for (unsigned int v = 0; v < vertexCount && fits; v++)
+	{
+		const float position[3] = { arrays.posArr[v * 3 + 0], arrays.posArr[v * 3 + 1], arrays.posArr[v * 3 + 2] };
+		const float normal[3] = { arrays.norArr[v * 3 + 0], arrays.norArr[v * 3 + 1], arrays.norArr[v * 3 + 2] };
 
-		std::memcpy((char*)msg + offset, meshData.norXYZ, sizeof(float) * norArr.length());
+		fits = quantizeVertex(position, normal, arrays.boundsMin, arrays.boundsMax, &arrays.posQuantized[v * 4], &arrays.norOctahedral[v * 2]);
 
-		comlib.send(msg, msgSize);
+		// Uv, half floats lose precision away from 0 and end at 65504
+		for (int i = 0; i < 2; i++)
+		{
+			arrays.uvHalf[v * 2 + i] = floatToHalf(arrays.uvArr[v * 2 + i]);
+
+			if (!(std::fabs(halfToFloat(arrays.uvHalf[v * 2 + i]) - arrays.uvArr[v * 2 + i]) <= QUANTIZE_UV_TOLERANCE))
+				fits = false;
+		}
+	}
 
-		delete[] meshData.posXYZ;
-		delete[] meshData.UV;
-		delete[] meshData.norXYZ;
+	if (!fits)
+	{
+		arrays.posQuantized.clear();
+		arrays.uvHalf.clear();
+		arrays.norOctahedral.clear();
 	}
+
+	return fits;
 }
 
-void meshUpdate(MObject& node)
+// Position and normal of one vertex as VERTEX_QUANTIZED, false if they do not decode within the tolerances,
+// e.g. a position outside the bounds
+bool quantizeVertex(const float position[3], const float normal[3], const float boundsMin[3], const float boundsMax[3], unsigned short posQuantized[4], unsigned short norOctahedral[2])
 {
-	MFnMesh mesh(node, &status);
+	bool fits = true;
 
-	if (status == MStatus::kSuccess)
+	// Position, 0 to 65535 across the bounds
+	for (int axis = 0; axis < 3; axis++)
 	{
-		// Fetch data from mesh	
-		int numPoints = 0;
-		int numTriangles = 0;
-		char materialID[37]{};
+		const float size = boundsMax[axis] - boundsMin[axis];
+		const float unit = (size > 0.0f) ? (position[axis] - boundsMin[axis]) / size : 0.0f;
+		const unsigned short q = (unsigned short)std::lround(std::min(std::max(unit, 0.0f), 1.0f) * 65535.0f);
 
-		MFloatArray posArr; // Vertex positions
-		MFloatArray uvArr;	// Vertex uvs
-		MFloatArray norArr; // Vertex normals
+		posQuantized[axis] = q;
 
-		MItMeshPolygon polyIter(node, &status);
+		const float decoded = boundsMin[axis] + size * (q / 65535.0f);
 
-		// Iterate each face
-		for (; !polyIter.isDone(); polyIter.next())
-		{
+		if (!(std::fabs(decoded - position[axis]) <= QUANTIZE_POSITION_TOLERANCE))
+			fits = false;
+	}
 
-			// Get the number of tris per face
-			int currentNumTris = 0;
-			polyIter.numTriangles(currentNumTris);
-			numTriangles += currentNumTris;
+	posQuantized[3] = 0;
 
-			// Get vertex position and vertex id from all trinagles per face 
-			MPointArray points;
-			MIntArray vertexList;
-			polyIter.getTriangles(points, vertexList);
-			numPoints += points.length();
+	// Normal, onto the octahedron |x| + |y| + |z| = 1 with the lower half folded over the upper
+	const float nx = normal[0];
+	const float ny = normal[1];
+	const float nz = normal[2];
+	const float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+	const float sum = std::fabs(nx) + std::fabs(ny) + std::fabs(nz);
 
-			// Iterate through each point of all trinagles per face (3 * 2)
-			for (size_t i = 0; i < points.length(); i++)
-			{
+	float ex = (sum > 0.0f) ? nx / sum : 0.0f;
+	float ey = (sum > 0.0f) ? ny / sum : 0.0f;
 
-				posArr.append(points[i].x);
-				posArr.append(points[i].y);
-				posArr.append(points[i].z);
+	if (nz < 0.0f)
+	{
+		const float fx = (1.0f - std::fabs(ey)) * ((ex >= 0.0f) ? 1.0f : -1.0f);
+		const float fy = (1.0f - std::fabs(ex)) * ((ey >= 0.0f) ? 1.0f : -1.0f);
+		ex = fx;
+		ey = fy;
+	}
 
-				// Get vertex UVs
-				float2 uvPoint;
-				polyIter.getUVAtPoint(points[i], uvPoint);
-				uvArr.append(uvPoint[0]);
-				uvArr.append(1.0 - uvPoint[1]);
+	norOctahedral[0] = (unsigned short)std::lround((ex * 0.5f + 0.5f) * 65535.0f);
+	norOctahedral[1] = (unsigned short)std::lround((ey * 0.5f + 0.5f) * 65535.0f);
 
-				// Get vertex normals
-				MVector normalPoint;
-				polyIter.getNormal(normalPoint);
-				norArr.append(normalPoint.x);
-				norArr.append(normalPoint.y);
-				norArr.append(normalPoint.z);
+	// Decoded as in the vertex shader
+	float dx = norOctahedral[0] / 65535.0f * 2.0f - 1.0f;
+	float dy = norOctahedral[1] / 65535.0f * 2.0f - 1.0f;
+	const float dz = 1.0f - std::fabs(dx) - std::fabs(dy);
+	const float fold = std::max(-dz, 0.0f);
 
-			}
-		}
+	dx += (dx >= 0.0f) ? -fold : fold;
+	dy += (dy >= 0.0f) ? -fold : fold;
 
+	const float decodedLength = std::sqrt(dx * dx + dy * dy + dz * dz);
 
-		// Get connected mat uuid
-		MItDependencyGraph itSE(node, MFn::kShadingEngine, MItDependencyGraph::kDownstream, MItDependencyGraph::kDepthFirst, MItDependencyGraph::kNodeLevel);
-		for (; !itSE.isDone(); itSE.next())
+	// A normal of length 0 has no direction to keep
+	if (length > 0.0f && !((dx * nx + dy * ny + dz * nz) / (decodedLength * length) >= QUANTIZE_NORMAL_TOLERANCE))
+		fits = false;
+
+	return fits;
+}
+
+// IEEE half float, rounded to nearest. Too large for a half is infinity.
+unsigned short floatToHalf(float value)
+{
+	unsigned int bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	const unsigned int sign = (bits >> 16) & 0x8000;
+	const int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	unsigned int mantissa = bits & 0x7fffff;
+
+	if (exponent >= 31)
+		return (unsigned short)(sign | 0x7c00);
+
+	// Subnormal, or too small for one
+	if (exponent <= 0)
+	{
+		if (exponent < -10)
+			return (unsigned short)sign;
+
+		mantissa |= 0x800000;
+
+		const int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+
+		if ((mantissa >> (shift - 1)) & 1)
+			half++;
+
+		return (unsigned short)(sign | half);
+	}
+
+	unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+
+	// Rounding up can carry into the exponent, which is still the nearest half
+	if (mantissa & 0x1000)
+		half++;
+
+	return (unsigned short)half;
+}
+
+float halfToFloat(unsigned short half)
+{
+	const int exponent = (half >> 10) & 0x1f;
+	const int mantissa = half & 0x3ff;
+
+	float value;
+
+	if (exponent == 0)
+		value = std::ldexp((float)mantissa, -24);
+	else if (exponent == 31)
+		value = INFINITY;
+	else
+		value = std::ldexp((float)(mantissa | 0x400), exponent - 25);
+
+	return (half & 0x8000) ? -value : value;
+}
+
+void writeMeshArrays(char* data, const MeshArrays& arrays, const sMeshHeader& header)
+{
+	int offset = 0;
+
+	if (header.format == VERTEX_QUANTIZED)
+	{
+		std::memcpy(data + offset, arrays.posQuantized.data(), sizeof(unsigned short) * arrays.posQuantized.size());
+		offset += sizeof(unsigned short) * arrays.posQuantized.size();
+
+		std::memcpy(data + offset, arrays.uvHalf.data(), sizeof(unsigned short) * arrays.uvHalf.size());
+		offset += sizeof(unsigned short) * arrays.uvHalf.size();
+
+		std::memcpy(data + offset, arrays.norOctahedral.data(), sizeof(unsigned short) * arrays.norOctahedral.size());
+		offset += sizeof(unsigned short) * arrays.norOctahedral.size();
+	}
+	else
+	{
+		arrays.posArr.get((float*)(data + offset));
+		offset += sizeof(float) * arrays.posArr.length();
+
+		arrays.uvArr.get((float*)(data + offset));
+		offset += sizeof(float) * arrays.uvArr.length();
+
+		arrays.norArr.get((float*)(data + offset));
+		offset += sizeof(float) * arrays.norArr.length();
+	}
+
+	// Indices narrowed to 16 bits whenever they fit
+	if (header.indexSize == sizeof(unsigned short))
+	{
+		unsigned short* indices = (unsigned short*)(data + offset);
+
+		for (size_t i = 0; i < arrays.indices.size(); i++)
 		{
-			MFnDependencyNode shadingEngine(itSE.currentItem());
-			MPlug surfaceShader = shadingEngine.findPlug("surfaceShader", &status);
-			if (status == MS::kSuccess)
-			{
-				MPlugArray plugArr;
-				surfaceShader.connectedTo(plugArr, true, false);
-				if (plugArr.length())
-				{
-					MFnDependencyNode mat(plugArr[0].node());
-					std::memcpy(materialID, mat.uuid().asString().asChar(), 37);
-				}
-			}
+			indices[i] = (unsigned short)arrays.indices[i];
 		}
+	}
+	else
+	{
+		std::memcpy(data + offset, arrays.indices.data(), sizeof(unsigned int) * arrays.indices.size());
+	}
+}
 
+// Sends a mesh whole as an ADD or UPDATE, false if it did not go out.
+// The vertex arrays go in the blob heap and only the handle through comlib.
+// If the heap is full they are sent inline after the header instead, compressed if it is worth it.
+template <ACTIVITY Activity>
+bool sendMesh(NodeHandle handle, const MeshArrays& arrays, sMeshHeader& header)
+{
+	using Layout = MessageLayout<MESH, Activity>;
 
-		// Message data
-		sHeader mainHeader;
-		mainHeader.activity = UPDATE;
-		mainHeader.type = MESH;
-		std::memcpy(mainHeader.nodeID, mesh.uuid().asString().asChar(), 37);
+	header.blob = beginBlob(meshArraysSize(header));
 
-		sMeshHeader meshHeader;
-		meshHeader.vertexCount = numPoints;
-		meshHeader.triangleCount = numTriangles;
-		std::memcpy(meshHeader.connectedMatID, materialID, 37);
+	if (header.blob.length == 0)
+		compressMeshArrays(arrays, header);
 
-		sMeshData meshData;
-		meshData.posXYZ = new float[posArr.length()];
-		posArr.get(meshData.posXYZ);
-		meshData.UV = new float[uvArr.length()];
-		uvArr.get(meshData.UV);
-		meshData.norXYZ = new float[norArr.length()];
-		norArr.get(meshData.norXYZ);
+	msgSize = Layout::size(header);
 
-		// Message send
-		msgSize = 0;
-		msgSize += sizeof(sHeader);
-		msgSize += sizeof(sMeshHeader);
+	// Write the vertex arrays straight into shared memory, no staging copies
+	char* data = beginMessage(msgSize);
+	char* arraysData = (header.blob.length > 0) ? blobHeap.data(header.blob) : data + Layout::variableOffset;
 
-		msgSize += sizeof(float) * posArr.length();
-		msgSize += sizeof(float) * uvArr.length();
-		msgSize += sizeof(float) * norArr.length();
+	writeMessage<MESH, Activity>(data, msgSize, handle, header);
 
-		int offset = 0;
+	if (header.compressedSize > 0)
+		std::memcpy(arraysData, meshCompressed.data(), header.compressedSize);
+	else
+		writeMeshArrays(arraysData, arrays, header);
 
-		std::memcpy((char*)msg, &mainHeader, sizeof(sHeader));
-		offset += sizeof(sHeader);
+	const bool sent = endMessage(data, msgSize);
 
-		std::memcpy((char*)msg + offset, &meshHeader, sizeof(sMeshHeader));
-		offset += sizeof(sMeshHeader);
+	endBlob(header.blob, sent);
 
-		std::memcpy((char*)msg + offset, meshData.posXYZ, sizeof(float) * posArr.length());
-		offset += sizeof(float) * posArr.length();
+	return sent;
+}
 
-		std::memcpy((char*)msg + offset, meshData.UV, sizeof(float) * uvArr.length());
-		offset += sizeof(float) * uvArr.length();
+// Compresses the arrays of a mesh into meshCompressed and sets header.compressedSize, false if they go raw.
+// Every try measures the ratio and the time it took, one that did not pay off sends the next COMPRESS_BACKOFF raw.
+bool compressMeshArrays(const MeshArrays& arrays, sMeshHeader& header)
+{
+	header.compressedSize = 0;
 
-		std::memcpy((char*)msg + offset, meshData.norXYZ, sizeof(float) * norArr.length());
+	const size_t arraysSize = meshArraysSize(header);
 
-		comlib.send(msg, msgSize);
+	if (arraysSize < COMPRESS_SIZE)
+		return false;
 
-		delete[] meshData.posXYZ;
-		delete[] meshData.UV;
-		delete[] meshData.norXYZ;
+	if (compressBackoff > 0)
+	{
+		compressBackoff--;
+		return false;
+	}
 
-		//MItDependencyGraph itSE(node, MFn::kShadingEngine, MItDependencyGraph::kDownstream, MItDependencyGraph::kDepthFirst, MItDependencyGraph::kNodeLevel);
-		//for (; !itSE.isDone(); itSE.next())
-		//{
-		//	materialUpdate(itSE.currentItem());
-		//}
+	meshStaging.resize(arraysSize);
+	writeMeshArrays(meshStaging.data(), arrays, header);
+
+	meshCompressed.resize(sdefl_bound((int)arraysSize));
+
+	const auto start = std::chrono::steady_clock::now();
+	const int compressedSize = sdeflate(&deflater, meshCompressed.data(), meshStaging.data(), (int)arraysSize, COMPRESS_LEVEL);
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	const bool small = compressedSize > 0 && compressedSize <= arraysSize * COMPRESS_RATIO;
+	const bool fast = small && (arraysSize - compressedSize) / double(1 << 20) >= COMPRESS_RATE * seconds;
+
+	if (!fast)
+		compressBackoff = COMPRESS_BACKOFF;
+
+	// Compressed but too slow still goes compressed, the time is spent already
+	if (!small)
+		return false;
+
+	header.compressedSize = compressedSize;
+
+	return true;
+}
+
+// Hash of everything about a mesh a DELTA does not carry: its faces, their normal and uv ids, and the uvs
+unsigned long long meshLayout(MFnMesh& mesh)
+{
+	unsigned long long hash = 14695981039346656037ull; // FNV-1a
+
+	auto add = [&](const unsigned int value)
+	{
+		hash = (hash ^ value) * 1099511628211ull;
+	};
+
+	MIntArray counts;
+	MIntArray ids;
+
+	mesh.getVertices(counts, ids);
+
+	for (unsigned int i = 0; i < counts.length(); i++) add(counts[i]);
+	for (unsigned int i = 0; i < ids.length(); i++) add(ids[i]);
+
+	mesh.getNormalIds(counts, ids);
+
+	for (unsigned int i = 0; i < ids.length(); i++) add(ids[i]);
+
+	mesh.getAssignedUVs(counts, ids);
+
+	for (unsigned int i = 0; i < counts.length(); i++) add(counts[i]);
+	for (unsigned int i = 0; i < ids.length(); i++) add(ids[i]);
+
+	MFloatArray uArr;
+	MFloatArray vArr;
+	mesh.getUVs(uArr, vArr);
+
+	for (unsigned int i = 0; i < uArr.length(); i++)
+	{
+		unsigned int u, v;
+		std::memcpy(&u, &uArr[i], sizeof(u));
+		std::memcpy(&v, &vArr[i], sizeof(v));
+		add(u);
+		add(v);
+	}
+
+	return hash;
+}
+
+// Keeps what a mesh was sent as for its next DELTA, forgets it if the message did not go out
+void rememberMesh(NodeHandle handle, const MeshArrays& arrays, const sMeshHeader& header, unsigned long long layout, bool sent)
+{
+	if (!sent)
+	{
+		sentMeshes.erase(handle);
+		return;
 	}
+
+	SentMesh& last = sentMeshes[handle];
+
+	last.layout = layout;
+	last.material = header.material;
+	last.format = header.format;
+	std::memcpy(last.boundsMin, header.boundsMin, sizeof(last.boundsMin));
+	std::memcpy(last.boundsMax, header.boundsMax, sizeof(last.boundsMax));
+
+	last.points = arrays.points;
+	last.normalIds = arrays.normalIds;
+
+	last.positions.resize(arrays.posArr.length());
+	last.normals.resize(arrays.norArr.length());
+
+	arrays.posArr.get(last.positions.data());
+	arrays.norArr.get(last.normals.data());
+}
+
+// Sends the vertices of a mesh that moved since it was last sent as a DELTA, without going through its faces,
+// and a LINK if it was given another material.
+// False if it has to be sent whole: it was not sent yet, its layout changed (meshLayout)
+// or a vertex moved out of what its quantization covers.
+bool meshDelta(MObject& node)
+{
+	const NodeHandle handle = handleOf(node);
+	auto sent = sentMeshes.find(handle);
+
+	if (sent == sentMeshes.end())
+		return false;
+
+	SentMesh& last = sent->second;
+	MFnMesh mesh(node);
+
+	if (meshLayout(mesh) != last.layout)
+		return false;
+
+	const NodeHandle material = meshMaterial(node);
+
+	if (material != last.material)
+	{
+		const size_t size = MessageLayout<MESH, LINK>::size(material);
+
+		writeMessage<MESH, LINK>(beginRecord(LANE_BULK, size), size, handle, material);
+
+		last.material = material;
+	}
+
+	MPointArray points;
+	mesh.getPoints(points);
+
+	MFloatVectorArray normals;
+	mesh.getNormals(normals);
+
+	const int vertexCount = (int)last.points.size();
+
+	// Runs of vertices that changed, the cache takes their new values right away.
+	// Whatever happens next either sends them or sends the mesh whole, which replaces the cache.
+	std::vector<sVertexRange> ranges;
+	size_t rangeVertices = 0;
+
+	for (int v = 0; v < vertexCount; v++)
+	{
+		const MPoint& point = points[last.points[v]];
+		const MFloatVector& normal = normals[last.normalIds[v]];
+
+		const float position[3] = { (float)point.x, (float)point.y, (float)point.z };
+		const float direction[3] = { normal.x, normal.y, normal.z };
+
+		if (std::memcmp(position, &last.positions[v * 3], sizeof(position)) == 0 &&
+			std::memcmp(direction, &last.normals[v * 3], sizeof(direction)) == 0)
+			continue;
+
+		std::memcpy(&last.positions[v * 3], position, sizeof(position));
+		std::memcpy(&last.normals[v * 3], direction, sizeof(direction));
+
+		if (!ranges.empty() && v - (ranges.back().first + ranges.back().count) <= DELTA_GAP)
+		{
+			rangeVertices += v + 1 - (ranges.back().first + ranges.back().count);
+			ranges.back().count = v + 1 - ranges.back().first;
+		}
+		else
+		{
+			ranges.push_back({ v, 1 });
+			rangeVertices++;
+		}
+	}
+
+	// Nothing moved
+	if (ranges.empty())
+		return true;
+
+	// Positions of every range, then their normals, in the format the mesh was sent in
+	const bool quantized = (last.format == VERTEX_QUANTIZED);
+	const size_t posSize = quantized ? sizeof(unsigned short) * 4 : sizeof(float) * 3;
+	const size_t norSize = quantized ? sizeof(unsigned short) * 2 : sizeof(float) * 3;
+
+	std::vector<char> arrays((posSize + norSize) * rangeVertices);
+	char* positions = arrays.data();
+	char* directions = positions + posSize * rangeVertices;
+	size_t k = 0;
+
+	for (const sVertexRange& range : ranges)
+	{
+		for (int v = range.first; v < range.first + range.count; v++, k++)
+		{
+			if (quantized)
+			{
+				unsigned short posQuantized[4];
+				unsigned short norOctahedral[2];
+
+				if (!quantizeVertex(&last.positions[v * 3], &last.normals[v * 3], last.boundsMin, last.boundsMax, posQuantized, norOctahedral))
+					return false;
+
+				std::memcpy(positions + k * posSize, posQuantized, posSize);
+				std::memcpy(directions + k * norSize, norOctahedral, norSize);
+			}
+			else
+			{
+				std::memcpy(positions + k * posSize, &last.positions[v * 3], posSize);
+				std::memcpy(directions + k * norSize, &last.normals[v * 3], norSize);
+			}
+		}
+	}
+
+	sMeshDelta delta{};
+	delta.vertexCount = vertexCount;
+	delta.rangeCount = (int)ranges.size();
+	delta.rangeVertices = (int)rangeVertices;
+	delta.format = last.format;
+
+	// Message send
+	msgSize = MessageLayout<MESH, DELTA>::size(delta);
+
+	char* data = beginMessage(msgSize);
+	char* rangesData = data + MessageLayout<MESH, DELTA>::variableOffset;
+
+	writeMessage<MESH, DELTA>(data, msgSize, handle, delta);
+
+	std::memcpy(rangesData, ranges.data(), sizeof(sVertexRange) * ranges.size());
+	std::memcpy(rangesData + sizeof(sVertexRange) * ranges.size(), arrays.data(), arrays.size());
+
+	// Renderers did not get it, the next update goes whole
+	if (!endMessage(data, msgSize))
+		sentMeshes.erase(sent);
+
+	return true;
 }
 
 void meshRemove(MObject& node)
@@ -397,16 +964,13 @@ void meshRemove(MObject& node)
 	MFnMesh mesh(node, &status);
 	if (status == MStatus::kSuccess)
 	{
-		sHeader mainHeader;
-		mainHeader.activity = REMOVE;
-		mainHeader.type = MESH;
-		std::memcpy(&mainHeader.nodeID, mesh.uuid().asString().asChar(), 37);
-
-		msgSize = sizeof(sHeader);
+		const NodeHandle handle = handleOf(node);
 
-		std::memcpy((char*)msg, &mainHeader, sizeof(sHeader));
+		// An update held back for it has nothing left to update
+		deferredMeshes.erase(std::remove(deferredMeshes.begin(), deferredMeshes.end(), handle), deferredMeshes.end());
+		sentMeshes.erase(handle);
 
-		comlib.send(msg, msgSize);
+		sendRemove(MESH, handle);
 
 		MItDependencyGraph itSE(node, MFn::kShadingEngine, MItDependencyGraph::kDownstream, MItDependencyGraph::kDepthFirst, MItDependencyGraph::kNodeLevel, &status);
 		for (; !itSE.isDone(); itSE.next())
@@ -424,7 +988,7 @@ void materialAdd(MObject& node)
 		// Fetch data from material
 		float color[3]{ 0,1,0 };
 		int pathSize{ 0 };
-		char* texturePath{};
+		MString texturePath;
 
 		MFnDependencyNode dependencyNode(node);
 
@@ -466,10 +1030,7 @@ void materialAdd(MObject& node)
 						if (filePathName.numChars() > 0 && status == MS::kSuccess)
 						{
 							pathSize = filePathName.length() + 1;
-
-							texturePath = new char[pathSize];
-
-							memcpy(texturePath, filePathName.asChar(), pathSize);
+							texturePath = filePathName;
 
 						}
 					}
@@ -490,39 +1051,19 @@ void materialAdd(MObject& node)
 			}
 
 			// Message data
-			sHeader sheader;
-			sheader.activity = ADD;
-			sheader.type = MATERIAL;
-			std::memcpy(sheader.nodeID, material.uuid().asString().asChar(), 37);
-
 			sMaterial smaterial;
 
 			smaterial.color[0] = color[0];
-			smaterial.color[1] = color[1];
-			smaterial.color[2] = color[2];
-
-			smaterial.pathSize = pathSize;
-			smaterial.texturePath = texturePath;
-
-			// Message send
-			msgSize = 0;
-			msgSize += sizeof(sHeader);
-			msgSize += sizeof(sMaterial);
-			msgSize += sizeof(char) * pathSize;
-
-			int offset = 0;
-
-			std::memcpy((char*)msg, &sheader, sizeof(sHeader));
-			offset += sizeof(sHeader);
-
-			std::memcpy((char*)msg + offset, &smaterial, sizeof(sMaterial));
-			offset += sizeof(sMaterial);
+			smaterial.color[1] = color[1];
+			smaterial.color[2] = color[2];
 
-			std::memcpy((char*)msg + offset, &smaterial.texturePath[0], smaterial.pathSize);
+			smaterial.pathSize = pathSize;
 
-			comlib.send(msg, msgSize);
+			// Message send
+			msgSize = writeMessage<MATERIAL, ADD>(msg, MSGSIZE, handleOf(material.object()), smaterial, texturePath.asChar());
 
-			delete[] texturePath;
+			if (msgSize > 0)
+				sendBulk(msg, msgSize);
 		}
 	}
 }
@@ -535,7 +1076,7 @@ void materialUpdate(MObject& node)
 		// Fetch data from material
 		float color[3]{ 0,1,0 };
 		int pathSize{ 0 };
-		char* texturePath{};
+		MString texturePath;
 
 		MFnDependencyNode dependencyNode(node);
 
@@ -577,12 +1118,7 @@ void materialUpdate(MObject& node)
 						if (filePathName.numChars() > 0 && status == MS::kSuccess)
 						{
 							pathSize = filePathName.length() + 1;
-
-							texturePath = new char[pathSize];
-
-							memcpy(texturePath, filePathName.asChar(), pathSize);
-
-
+							texturePath = filePathName;
 						}
 					}
 				}
@@ -602,37 +1138,20 @@ void materialUpdate(MObject& node)
 			}
 
 			// Message data
-			sHeader sheader;
-			sheader.activity = UPDATE;
-			sheader.type = MATERIAL;
-			std::memcpy(sheader.nodeID, material.uuid().asString().asChar(), 37);
-
 			sMaterial smaterial;
 			smaterial.color[0] = color[0];
 			smaterial.color[1] = color[1];
 			smaterial.color[2] = color[2];
 			smaterial.pathSize = pathSize;
-			smaterial.texturePath = texturePath;
 
 			// Message send
-			msgSize = 0;
-			msgSize += sizeof(sHeader);
-			msgSize += sizeof(sMaterial);
-			msgSize += pathSize;  //char arr
-
-			int offset = 0;
-
-			std::memcpy((char*)msg, &sheader, sizeof(sHeader));
-			offset += sizeof(sHeader);
-
-			std::memcpy((char*)msg + offset, &smaterial, sizeof(sMaterial));
-			offset += sizeof(sMaterial);
+			msgSize = writeMessage<MATERIAL, UPDATE>(msg, MSGSIZE, handleOf(material.object()), smaterial, texturePath.asChar());
 
-			std::memcpy((char*)msg + offset, &smaterial.texturePath[0], smaterial.pathSize);
+			// After what is batched for the lane, it may be older than this
+			flushPacket(LANE_INTERACTIVE);
 
-			comlib.send(msg, msgSize);
-
-			delete[] texturePath;
+			if (msgSize > 0)
+				comlib.send(msg, msgSize, LANE_INTERACTIVE);
 		}
 	}
 }
@@ -642,16 +1161,7 @@ void materialRemove(MObject& node)
 	MMaterial material(node, &status);
 	if (status == MStatus::kSuccess)
 	{
-		sHeader sheader;
-		sheader.activity = REMOVE;
-		sheader.type = MATERIAL;
-		std::memcpy(&sheader.nodeID, MFnDependencyNode(node).uuid().asString().asChar(), 37);
-
-		msgSize = sizeof(sHeader);
-
-		std::memcpy((char*)msg, &sheader, sizeof(sHeader));
-
-		comlib.send(msg, msgSize);
+		sendRemove(MATERIAL, handleOf(node));
 	}
 }
 
@@ -669,10 +1179,7 @@ void transformAdd(MObject& node)
 
 		path.inclusiveMatrix().get(matrix);
 
-		sHeader mainHeader;
-		mainHeader.activity = ADD;
-		mainHeader.type = TRANSFORM;
-		std::memcpy(mainHeader.nodeID, dag.uuid().asString().asChar(), 37);
+		const NodeHandle handle = handleOf(node);
 
 		sTransform transformData;
 		transformData = {
@@ -682,19 +1189,12 @@ void transformAdd(MObject& node)
 			matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]
 		};
 
-		// Message send
-		msgSize = 0;
-		msgSize += sizeof(sHeader);
-		msgSize += sizeof(sTransform);
+		// Message send, batched with the other adds and removes of the burst
+		const size_t size = MessageLayout<TRANSFORM, ADD>::size(transformData);
 
-		int offset = 0;
+		writeMessage<TRANSFORM, ADD>(beginRecord(LANE_BULK, size), size, handle, transformData);
 
-		std::memcpy((char*)msg, &mainHeader, sizeof(sHeader));
-		offset += sizeof(sHeader);
-
-		std::memcpy((char*)msg + offset, &transformData, sizeof(sTransform));
-
-		comlib.send(msg, msgSize);
+		writeState<TRANSFORM>(handle, transformData);
 
 	}
 }
@@ -715,11 +1215,6 @@ void transformUpdate(MObject& node)
 
 		path.inclusiveMatrix().get(matrix);
 
-		sHeader mainHeader;
-		mainHeader.activity = UPDATE;
-		mainHeader.type = TRANSFORM;
-		std::memcpy(mainHeader.nodeID, dag.uuid().asString().asChar(), 37);
-
 		sTransform transformData;
 		transformData = {
 			matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0],
@@ -728,19 +1223,8 @@ void transformUpdate(MObject& node)
 			matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]
 		};
 
-		// Message send
-		msgSize = 0;
-		msgSize += sizeof(sHeader);
-		msgSize += sizeof(sTransform);
-
-		int offset = 0;
-
-		std::memcpy((char*)msg, &mainHeader, sizeof(sHeader));
-		offset += sizeof(sHeader);
-
-		std::memcpy((char*)msg + offset, &transformData, sizeof(sTransform));
-
-		comlib.send(msg, msgSize);
+		// Only the newest matrix matters, overwrite the node's slot instead of queueing a message
+		writeState<TRANSFORM>(handleOf(node), transformData);
 
 		MString str = PLUGINNAME;
 		str += "AttributeChange (";
@@ -770,16 +1254,12 @@ void transformRemove(MObject& node)
 	MFnTransform transform(node, &status);
 	if (status == MStatus::kSuccess)
 	{
-		sHeader mainHeader;
-		mainHeader.activity = REMOVE;
-		mainHeader.type = TRANSFORM;
-		std::memcpy(&mainHeader.nodeID, transform.uuid().asString().asChar(), 37);
-
-		msgSize = sizeof(sHeader);
+		const NodeHandle handle = handleOf(node);
 
-		std::memcpy((char*)msg, &mainHeader, sizeof(sHeader));
+		sendRemove(TRANSFORM, handle);
 
-		comlib.send(msg, msgSize);
+		stateTable.erase(handle);
+		stateSlotsWarned = false;
 	}
 }
 
@@ -949,13 +1429,13 @@ void attributeChangedMesh(MNodeMessage::AttributeMessage msg, MPlug& plug, MPlug
 
 			if (status == MS::kSuccess)
 			{
-				meshUpdate(plug.node());
+				queueMeshUpdate(plug.node());
 			}
 		}
 	}
 
 	if (msg & (MNodeMessage::kConnectionMade)) {
-		meshUpdate(plug.node());
+		queueMeshUpdate(plug.node());
 	}
 
 	attributeCallbackInfo(msg, plug, otherPlug);
@@ -973,7 +1453,7 @@ void attributeChangedShadingEngine(MNodeMessage::AttributeMessage msg, MPlug& pl
 
 		for (; !itMesh.isDone(); itMesh.next())
 		{
-			meshUpdate(itMesh.currentItem());
+			queueMeshUpdate(itMesh.currentItem());
 		}
 	}
 	attributeCallbackInfo(msg, plug, otherPlug);
@@ -1112,12 +1592,6 @@ void updateCamera()
 	fovy = camera.verticalFieldOfView() * (180.0 / 3.141592653589793238463);
 	projection = camera.isOrtho();
 
-	sHeader mainHeader;
-
-	mainHeader.activity = UPDATE;
-	mainHeader.type = CAMERA;
-	std::memcpy(&mainHeader.nodeID, camera.uuid().asString().asChar(), 37);
-
 	sCamera cam{
 		{position[0], position[1], position[2]},						// position
 		{(float)target[0], (float)target[1], (float)target[2]},			// forward
@@ -1126,14 +1600,501 @@ void updateCamera()
 		projection														// projection
 	};
 
-	// Send data
+	// Only the newest view matters, overwrite the camera slot instead of queueing a message
+	writeState<CAMERA>(NODE_NONE, cam);
+}
+
+void flushCallback(float elapsedTime, float lastTime, void* clientData)
+{
+	// Hellos, resync requests and acks from renderers
+	readFeedback();
+
+	// Held back mesh updates, the newest state of each mesh once every renderer has caught up
+	while (!deferredMeshes.empty() && bulkCredit())
+	{
+		MObject node;
+
+		if (findNode(deferredMeshes.front(), node))
+			meshUpdate(node);
+
+		deferredMeshes.erase(deferredMeshes.begin());
+	}
+
+	// Small messages of the callbacks since the last flush, one message per lane
+	flushPackets();
+
+	// Over a socket, writes what a renderer's socket did not take yet and lets new renderers connect
+	comlib.flush();
+}
+
+void readFeedback()
+{
+	size_t length = 0;
+	const char* data = nullptr;
+
+	while ((data = comlib.peekReply(length)) != nullptr)
+	{
+		// Copied out first, answering sends messages and may close the connection the reply came on
+		std::vector<char> reply(data, data + length);
+		comlib.releaseReply();
+
+		if (length < sizeof(sFeedback))
+			continue;
+
+		sFeedback feedback{};
+		std::memcpy(&feedback, reply.data(), sizeof(sFeedback));
+
+		const sNodeRef* nodes = reinterpret_cast<const sNodeRef*>(reply.data() + sizeof(sFeedback));
+		const int nodeCount = (int)std::min((size_t)feedback.nodeCount, (length - sizeof(sFeedback)) / sizeof(sNodeRef));
+
+		// A renderer not seen before starts with a full window
+		size_t index = 0;
+
+		while (index < renderers.size() && renderers[index].renderer != feedback.renderer)
+			index++;
+
+		if (index == renderers.size())
+			renderers.push_back({ feedback.renderer, FEEDBACK_WINDOW, std::chrono::steady_clock::now() });
+
+		renderers[index].lastSeen = std::chrono::steady_clock::now();
+
+		if (feedback.kind == HELLO)
+		{
+			MString str = PLUGINNAME;
+			str += "Renderer joined with ";
+			str += nodeCount;
+			str += " nodes, sending what it is missing";
+			MGlobal::displayInfo(str);
+
+			renderers[index].credits = feedback.credits;
+			resyncScene(nodes, nodeCount);
+		}
+
+		if (feedback.kind == RESYNC)
+		{
+			for (int i = 0; i < nodeCount; i++)
+			{
+				resyncNode(nodes[i]);
+			}
+		}
+
+		if (feedback.kind == ACK)
+		{
+			renderers[index].credits = std::min(renderers[index].credits + feedback.credits, FEEDBACK_WINDOW);
+		}
+	}
+}
+
+void resyncScene(const sNodeRef* nodes, int nodeCount)
+{
+	std::vector<NodeHandle> rendererHas;
+	std::vector<NodeHandle> sceneHas;
+
+	// A node the renderer has under a handle from an earlier plugin session counts as missing and is sent again
+	for (int i = 0; i < nodeCount; i++)
+	{
+		const auto known = nodeHandles.find(std::string((const char*)nodes[i].uuid.bytes, sizeof(sUuid)));
+
+		rendererHas.push_back((known != nodeHandles.end() && known->second == nodes[i].node) ? nodes[i].node : NODE_NONE);
+	}
+
+	auto missing = [&](const NodeHandle node) { return std::find(rendererHas.begin(), rendererHas.end(), node) == rendererHas.end(); };
+
+	// Transforms with a mesh, the only ones the renderer is sent (see eventCallback)
+	MItDependencyNodes transforms(MFn::kTransform);
+
+	for (; !transforms.isDone(); transforms.next())
+	{
+		MObject transform = transforms.item();
+		MObject mesh = meshOf(transform);
+
+		if (mesh.isNull())
+			continue;
+
+		const NodeHandle transformHandle = handleOf(transform);
+		const NodeHandle meshHandle = handleOf(mesh);
+
+		sceneHas.push_back(transformHandle);
+		sceneHas.push_back(meshHandle);
+
+		if (missing(transformHandle) || missing(meshHandle))
+			resendPair(transform, mesh);
+	}
+
+	MItDependencyNodes shadingEngines(MFn::kShadingEngine);
+
+	for (; !shadingEngines.isDone(); shadingEngines.next())
+	{
+		MObject shadingEngine = shadingEngines.item();
+		MObject material = materialOf(shadingEngine);
+
+		if (material.isNull())
+			continue;
+
+		const NodeHandle materialHandle = handleOf(material);
+
+		sceneHas.push_back(materialHandle);
+
+		if (missing(materialHandle))
+		{
+			materialAdd(shadingEngine);
+			rendererHas.push_back(materialHandle); // lambert1 has two shading engines, send it once
+		}
+	}
+
+	// Nodes deleted while the renderer was away. Under a handle from an earlier session a node can not be named
+	// without risking one that has the handle now, it stays.
+	for (int i = 0; i < nodeCount; i++)
+	{
+		if (rendererHas[i] != NODE_NONE && std::find(sceneHas.begin(), sceneHas.end(), rendererHas[i]) == sceneHas.end())
+			sendRemove(nodes[i].type, rendererHas[i]);
+	}
+
+	// Camera and transforms over a socket live in the renderer's own table, which starts empty
+	updateCamera();
+}
+
+void resyncNode(const sNodeRef& node)
+{
+	MObject object;
+
+	if (!findNode(node.node, object))
+	{
+		// Deleted since, the renderer can let go of it
+		sendRemove(node.type, node.node);
+		return;
+	}
+
+	if (node.type == MATERIAL)
+	{
+		// The renderer knows a material by its surface shader, it is sent by its shading engine
+		MItDependencyGraph itSE(object, MFn::kShadingEngine, MItDependencyGraph::kDownstream, MItDependencyGraph::kDepthFirst, MItDependencyGraph::kNodeLevel);
+
+		if (!itSE.isDone())
+			materialAdd(itSE.currentItem());
+	}
+
+	if (node.type == MESH)
+	{
+		MObject transform = MFnDagNode(object).parent(0);
+
+		if (!transform.isNull())
+			resendPair(transform, object);
+	}
+
+	if (node.type == TRANSFORM)
+	{
+		MObject mesh = meshOf(object);
+
+		if (!mesh.isNull())
+			resendPair(object, mesh);
+	}
+}
+
+void resendPair(MObject& transform, MObject& mesh)
+{
+	// The renderer pairs meshes with transforms by the order they were added in,
+	// so both go again, removed first in case it has one of them
+	sendRemove(TRANSFORM, handleOf(transform));
+	sendRemove(MESH, handleOf(mesh));
+
+	transformAdd(transform);
+	meshAdd(mesh);
+}
+
+sUuid uuidOf(const MObject& node)
+{
+	sUuid uuid{};
+	MFnDependencyNode(node).uuid().get(uuid.bytes);
+
+	return uuid;
+}
+
+NodeHandle handleOf(const sUuid& uuid)
+{
+	const std::string key((const char*)uuid.bytes, sizeof(sUuid));
+	const auto known = nodeHandles.find(key);
+
+	if (known != nodeHandles.end())
+		return known->second;
+
+	// First time the node is sent, it keeps the handle even if it is deleted, an undo brings back the same uuid
+	const NodeHandle node = (NodeHandle)nodeUuids.size();
+
+	nodeHandles.emplace(key, node);
+	nodeUuids.push_back(uuid);
+
+	return node;
+}
+
+NodeHandle handleOf(const MObject& node)
+{
+	return handleOf(uuidOf(node));
+}
+
+bool findNode(const NodeHandle handle, MObject& node)
+{
+	if (handle == NODE_NONE || handle >= nodeUuids.size())
+		return false;
+
+	MSelectionList list;
+
+	if (list.add(MUuid(nodeUuids[handle].bytes)) != MS::kSuccess)
+		return false;
+
+	return list.getDependNode(0, node) == MS::kSuccess;
+}
+
+MObject meshOf(MObject& transform)
+{
+	// The transform's visible mesh, skipping intermediate objects of deformed meshes
+	MFnDagNode dag(transform, &status);
+
+	if (status != MS::kSuccess)
+		return MObject::kNullObj;
+
+	for (unsigned int i = 0; i < dag.childCount(); i++)
+	{
+		MObject child = dag.child(i);
+		MFnMesh mesh(child, &status);
+
+		if (status == MS::kSuccess && !mesh.isIntermediateObject())
+			return child;
+	}
+
+	return MObject::kNullObj;
+}
+
+MObject materialOf(MObject& shadingEngine)
+{
+	// Same lookup as materialAdd, the material node is what the renderer has the handle of
+	MPlug shaderPlug = MFnDependencyNode(shadingEngine).findPlug("surfaceShader", &status);
+
+	if (status != MS::kSuccess)
+		return MObject::kNullObj;
+
+	MPlugArray materialArr;
+	shaderPlug.connectedTo(materialArr, true, false);
+
+	if (materialArr.length() == 0)
+		return MObject::kNullObj;
+
+	return materialArr[0].node();
+}
+
+bool bulkCredit()
+{
+	// A renderer that went away without a word holds nothing back
+	const auto now = std::chrono::steady_clock::now();
+
+	renderers.erase(std::remove_if(renderers.begin(), renderers.end(), [&](const RendererCredits& r)
+		{ return now - r.lastSeen > std::chrono::milliseconds(FEEDBACK_TIMEOUT_MS); }), renderers.end());
+
+	for (const RendererCredits& r : renderers)
+	{
+		if (r.credits <= 0)
+			return false;
+	}
+
+	return true;
+}
+
+void spendCredit()
+{
+	for (RendererCredits& r : renderers)
+	{
+		r.credits--;
+	}
+}
+
+void queueMeshUpdate(MObject& node)
+{
+	// A renderer is behind, keep only which mesh changed and send its newest state when there is room
+	if (!deferredMeshes.empty() || !bulkCredit())
+	{
+		const NodeHandle handle = handleOf(node);
+
+		if (std::find(deferredMeshes.begin(), deferredMeshes.end(), handle) == deferredMeshes.end())
+			deferredMeshes.push_back(handle);
+
+		return;
+	}
+
+	meshUpdate(node);
+}
+
+char* beginMessage(size_t size)
+{
+	// What is batched goes first, renderers apply messages in the order they were sent
+	flushPacket(LANE_BULK);
+
+	// Reserve the message in place in the shared buffer
+	char* data = comlib.reserve(size, LANE_BULK);
+
+	// Too large for the buffer or the buffer is full, build it in the staging buffer and let send() fragment it
+	if (data == nullptr)
+	{
+		if (msgStaging.size() < size)
+			msgStaging.resize(size);
+
+		data = msgStaging.data();
+	}
+
+	return data;
+}
+
+bool endMessage(char* data, size_t size)
+{
+	if (data == msgStaging.data())
+	{
+		if (!comlib.send(data, size, LANE_BULK))
+		{
+			MGlobal::displayWarning(PLUGINNAME + MString("Message dropped, renderer is not reading"));
+			return false;
+		}
+	}
+	else
+	{
+		comlib.commit(data, size);
+	}
+
+	spendCredit();
+
+	return true;
+}
+
+BlobHandle beginBlob(size_t size)
+{
+	// Over a socket the renderer cannot see the heap, the arrays go inline
+	if (!comlib.shared())
+		return BlobHandle();
+
+	// Blobs every renderer has read past are free again
+	const size_t consumed = comlib.consumed(LANE_BULK);
+
+	while (!blobsInFlight.empty() && blobsInFlight.front().first <= consumed)
+	{
+		blobHeap.free(blobsInFlight.front().second);
+		blobsInFlight.pop();
+	}
+
+	return blobHeap.allocate(size);
+}
+
+void endBlob(const BlobHandle& blob, bool sent)
+{
+	if (!sent) // No renderer will ever see the handle
+		blobHeap.free(blob);
+	else if (blob.length > 0)
+		blobsInFlight.push({ comlib.written(LANE_BULK), blob });
+}
+
+// A message about node, see encodeMessage. An add tells the renderer which node the handle stands for.
+template <NODETYPE Type, ACTIVITY Activity>
+size_t writeMessage(char* data, size_t capacity, NodeHandle node, const typename MessageLayout<Type, Activity>::Fixed& fixed, const void* variable)
+{
+	return encodeMessage<Type, Activity>(data, capacity, node, nodeUuids[node], fixed, variable);
+}
+
+template <NODETYPE Type>
+void writeState(NodeHandle node, const typename MessageLayout<Type, UPDATE>::Fixed& value)
+{
+	if (stateTable.write((Type == CAMERA) ? STATE_CAMERA : node, &value, sizeof(value)) < 0 && comlib.shared() && !stateSlotsWarned)
+	{
+		MGlobal::displayWarning(PLUGINNAME + MString("More transforms than state slots (STATESLOTS), later ones are not shown"));
+		stateSlotsWarned = true;
+	}
+
+	// Over a socket the renderer keeps a table of its own, updated through messages batched per burst
+	if (!comlib.shared())
+	{
+		const size_t size = MessageLayout<Type, UPDATE>::size(value);
+
+		writeMessage<Type, UPDATE>(beginRecord(LANE_INTERACTIVE, size), size, node, value);
+	}
+}
+
+bool sendBulk(const char* data, size_t size)
+{
+	flushPacket(LANE_BULK);
+
+	if (!comlib.send(data, size, LANE_BULK))
+		return false;
+
+	spendCredit();
+
+	return true;
+}
+
+void sendRemove(NODETYPE type, NodeHandle node)
+{
+	encodeRemove(beginRecord(LANE_BULK, sizeof(sHeader)), sizeof(sHeader), type, node);
+}
+
+// Room for a message of size bytes in the lane's packet, written in place and sent with the packet.
+// A packet grows up to PACKETSIZE, a record that does not fit sends it first.
+char* beginRecord(LANE lane, size_t size)
+{
+	std::vector<char>& packet = packets[lane];
+
+	if (!packet.empty() && packet.size() + packetRecordSize(size) > PACKETSIZE)
+		flushPacket(lane);
+
+	// Header and sPacket are written when it is sent
+	if (packet.empty())
+		packet.resize(packetRecordsOffset());
+
+	const size_t offset = packet.size();
+	const int recordSize = (int)size;
+
+	packet.resize(offset + packetRecordSize(size));
+	std::memcpy(packet.data() + offset, &recordSize, sizeof(int));
+
+	packetRecords[lane]++;
+
+	return packet.data() + offset + sizeof(int);
+}
+
+// Sends the lane's packet, one credit for all of its records. False if the renderer is not reading.
+bool flushPacket(LANE lane)
+{
+	std::vector<char>& packet = packets[lane];
+
+	if (packet.empty())
+		return true;
+
+	const char* data = packet.data();
+	size_t size = packet.size();
+
+	if (packetRecords[lane] == 1)
+	{
+		// A single record goes as the message it is
+		int recordSize = 0;
+		std::memcpy(&recordSize, data + packetRecordsOffset(), sizeof(int));
+
+		data += packetRecordsOffset() + sizeof(int);
+		size = recordSize;
+	}
+	else
+	{
+		encodePacket(packet.data(), packetRecords[lane]);
+	}
 
-	msgSize = sizeof(sHeader) + sizeof(sCamera);
+	const bool sent = comlib.send(data, size, lane);
 
-	std::memcpy((char*)msg, &mainHeader, sizeof(sHeader));
-	std::memcpy((char*)msg + sizeof(sHeader), &cam, sizeof(sCamera));
+	if (sent && lane == LANE_BULK)
+		spendCredit();
 
-	comlib.send(msg, msgSize);
+	packet.clear();
+	packetRecords[lane] = 0;
+
+	return sent;
+}
+
+void flushPackets()
+{
+	flushPacket(LANE_INTERACTIVE);
+	flushPacket(LANE_BULK);
 }
 
 void appendCallback(MString name, MCallbackId* id, MStatus* status) {
@@ -1200,6 +2161,11 @@ void addCallbacks()
 
 	callbackId = MUiMessage::add3dViewPreRenderMsgCallback(MString("modelPanel4"), cameraUpdate, NULL, &status);
 	appendCallback("ViewPreRenderMsgCallback(modelPanel4)", &callbackId, &status);
+
+	// Keep a socket transport moving between node changes
+
+	callbackId = MTimerMessage::addTimerCallback(0.01f, flushCallback, NULL, &status);
+	appendCallback("TimerCallback", &callbackId, &status);
 }
 
 EXPORT MStatus initializePlugin(MObject obj) {
@@ -1218,6 +2184,17 @@ EXPORT MStatus initializePlugin(MObject obj) {
 	std::cout.set_rdbuf(MStreamUtils::stdOutStream().rdbuf());
 	std::cerr.set_rdbuf(MStreamUtils::stdErrorStream().rdbuf());
 
+	// Replies from before the plugin was loaded, the whole scene is sent below anyway
+	size_t replyLength = 0;
+
+	while (comlib.peekReply(replyLength) != nullptr)
+	{
+		comlib.releaseReply();
+	}
+
+	// The ring starts small and follows the scene, renderers move along with it
+	comlib.autoResize(BUFFERSIZE, BUFFERSIZE_MAX);
+
 	//update camera on init
 	updateCamera();
 
@@ -1238,5 +2215,7 @@ EXPORT MStatus uninitializePlugin(MObject obj) {
 
 	MMessage::removeCallbacks(callbackIdArray);
 
+	flushPackets();
+
 	return MS::kSuccess;
 }
\ No newline at end of file
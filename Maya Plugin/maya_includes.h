@@ -28,6 +28,7 @@
 
 #include <maya/MImage.h>
 #include <maya/MFloatPointArray.h>
+#include <maya/MFloatVectorArray.h>
 #include <maya/MPointArray.h>
 #include <maya/MIntArray.h>
 #include <maya/MPoint.h>
@@ -15,15 +15,23 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <random>
+#include <algorithm>
 #include <time.h>
 #include "raylib.h"
 #include "raymath.h"
 #include "rlgl.h"
+#include "external/sinfl.h" // DEFLATE decompressor, built into raylib with SUPPORT_COMPRESSION_API
 
 #include "MessageStructure.h"
 
 #define DEBUG 1
 
+// Vertex attribute types rlgl has no name for
+#define RL_UNSIGNED_SHORT 0x1403 // GL_UNSIGNED_SHORT
+#define RL_HALF_FLOAT 0x140B // GL_HALF_FLOAT
+#define MESH_VERTEX_BUFFERS 7 // MAX_MESH_VERTEX_BUFFERS of rmodels.c, UnloadMesh unloads that many
+
 // Light data
 struct Light {
 	int type;
@@ -48,6 +56,11 @@ enum LightType {
 
 Light CreateLight(int type, Vector3 position, Vector3 target, Color color, Shader shader);
 void UpdateLightValues(Shader shader, Light light);
+const char* ReadMeshArrays(const sMeshHeader& meshHeader, const char* payload, std::vector<char>& inflated);
+bool LoadIndexedModel(const sMeshHeader& meshHeader, const char* arrays, Shader shader, Model& model, std::vector<int>& vertices);
+void UploadQuantizedMesh(Mesh* mesh, const void* posXYZ, const void* UV, const void* norXY);
+bool ApplyMeshDelta(Model model, const std::vector<int>& vertices, const sMeshDelta& delta, const char* data);
+void UnloadModelMeshes(Model model);
 
 // Current amount of created lights
 int lightsCount = 0;
@@ -100,10 +113,382 @@ void UpdateLightValues(Shader shader, Light light)
 
 }
 
+// Vertex arrays of a mesh message: in the blob heap, inline after the header at payload, or compressed there and
+// inflated into inflated. nullptr if they do not inflate to the size of the arrays, or the blob is not one
+// of the heap that holds them. Over a socket the heap is this process's own, no message has a blob in it.
+const char* ReadMeshArrays(const sMeshHeader& meshHeader, const char* payload, std::vector<char>& inflated)
+{
+	if (meshHeader.blob.length > 0)
+		return comlib.shared() ? blobHeap.data(meshHeader.blob, meshArraysSize(meshHeader)) : nullptr;
+
+	if (meshHeader.compressedSize == 0)
+		return payload;
+
+	const size_t arraysSize = meshArraysSize(meshHeader);
+
+	if (inflated.size() < arraysSize)
+		inflated.resize(arraysSize);
+
+	if (sinflate(inflated.data(), (int)arraysSize, payload, meshHeader.compressedSize) != (int)arraysSize)
+		return nullptr;
+
+	return inflated.data();
+}
+
+// Model from the indexed arrays of a mesh message (see sMeshHeader).
+// raylib draws with 16 bit indices, a mesh with more vertices than they reach is cut into several.
+// Quantized vertices stay quantized on the GPU, the vertex shader decodes them (see VERTEX_QUANTIZED).
+// vertices gets the vertex of the message each vertex of each mesh is, for ApplyMeshDelta.
+// False with model and vertices left as they were if an index is not one of the vertices.
+bool LoadIndexedModel(const sMeshHeader& meshHeader, const char* arrays, Shader shader, Model& model, std::vector<int>& vertices)
+{
+	const int vertexCount = meshHeader.vertexCount;
+	const int indexCount = meshHeader.triangleCount * 3;
+	const bool quantized = (meshHeader.format == VERTEX_QUANTIZED);
+
+	// Bytes per vertex of each array
+	const size_t posSize = quantized ? sizeof(unsigned short) * 4 : sizeof(float) * 3;
+	const size_t uvSize = quantized ? sizeof(unsigned short) * 2 : sizeof(float) * 2;
+	const size_t norSize = quantized ? sizeof(unsigned short) * 2 : sizeof(float) * 3;
+
+	const char* posXYZ = arrays;
+	const char* UV = posXYZ + posSize * vertexCount;
+	const char* norXYZ = UV + uvSize * vertexCount;
+	const char* indices = norXYZ + norSize * vertexCount;
+
+	auto index = [&](const int i) -> int
+	{
+		if (meshHeader.indexSize == sizeof(unsigned short))
+			return ((const unsigned short*)indices)[i];
+
+		return (int)((const unsigned int*)indices)[i];
+	};
+
+	// Checked before anything is uploaded, a damaged index would be written through in remap
+	for (int i = 0; i < indexCount; i++)
+	{
+		const int vertex = index(i);
+
+		if (vertex < 0 || vertex >= vertexCount)
+			return false;
+	}
+
+	std::vector<Mesh> meshes;
+
+	// Vertices of the mesh being built in the order its triangles use them, and where each went (-1 not in it)
+	std::vector<int> meshVertices;
+	std::vector<int> remap(vertexCount, -1);
+	std::vector<unsigned short> meshIndices;
+
+	vertices.clear();
+
+	auto upload = [&]()
+	{
+		// In the order of the message instead, so a range of its vertices is a range of the mesh's too
+		std::vector<int> sorted(meshVertices);
+		std::sort(sorted.begin(), sorted.end());
+
+		for (size_t v = 0; v < sorted.size(); v++)
+		{
+			remap[sorted[v]] = (int)v;
+		}
+
+		for (unsigned short& index : meshIndices)
+		{
+			index = (unsigned short)remap[meshVertices[index]];
+		}
+
+		meshVertices.swap(sorted);
+		vertices.insert(vertices.end(), meshVertices.begin(), meshVertices.end());
+
+		sMeshData meshData{};
+
+		meshData.posXYZ = (float*)MemAlloc(meshVertices.size() * posSize);
+		meshData.UV = (float*)MemAlloc(meshVertices.size() * uvSize);
+		meshData.norXYZ = (float*)MemAlloc(meshVertices.size() * norSize);
+		meshData.indices = MemAlloc(meshIndices.size() * sizeof(unsigned short));
+
+		for (size_t v = 0; v < meshVertices.size(); v++)
+		{
+			memcpy((char*)meshData.posXYZ + v * posSize, posXYZ + meshVertices[v] * posSize, posSize);
+			memcpy((char*)meshData.UV + v * uvSize, UV + meshVertices[v] * uvSize, uvSize);
+			memcpy((char*)meshData.norXYZ + v * norSize, norXYZ + meshVertices[v] * norSize, norSize);
+
+			remap[meshVertices[v]] = -1;
+		}
+
+		memcpy(meshData.indices, meshIndices.data(), meshIndices.size() * sizeof(unsigned short));
+
+		Mesh tempMesh{};
+
+		tempMesh.vertexCount = (int)meshVertices.size();
+		tempMesh.triangleCount = (int)meshIndices.size() / 3;
+
+		tempMesh.indices = (unsigned short*)meshData.indices;
+
+		if (quantized)
+		{
+			// raylib only knows float arrays, the quantized ones are not kept once on the GPU
+			UploadQuantizedMesh(&tempMesh, meshData.posXYZ, meshData.UV, meshData.norXYZ);
+
+			MemFree(meshData.posXYZ);
+			MemFree(meshData.UV);
+			MemFree(meshData.norXYZ);
+		}
+		else
+		{
+			tempMesh.vertices = meshData.posXYZ;
+			tempMesh.texcoords = meshData.UV;
+			tempMesh.normals = meshData.norXYZ;
+
+			UploadMesh(&tempMesh, false);
+		}
+
+		meshes.push_back(tempMesh);
+		meshVertices.clear();
+		meshIndices.clear();
+	};
+
+	for (int i = 0; i + 2 < indexCount; i += 3)
+	{
+		// A triangle that would take the mesh past what 16 bits reach starts the next one
+		if (meshVertices.size() + 3 > SHORTINDEX_VERTICES)
+			upload();
+
+		for (int corner = i; corner < i + 3; corner++)
+		{
+			const int vertex = index(corner);
+
+			if (remap[vertex] < 0)
+			{
+				remap[vertex] = (int)meshVertices.size();
+				meshVertices.push_back(vertex);
+			}
+
+			meshIndices.push_back((unsigned short)remap[vertex]);
+		}
+	}
+
+	if (!meshIndices.empty())
+		upload();
+
+	// As LoadModelFromMesh, with every mesh drawn with the one material
+	model = Model{};
+
+	model.transform = MatrixIdentity();
+
+	model.meshCount = (int)meshes.size();
+	model.meshes = (Mesh*)MemAlloc(meshes.size() * sizeof(Mesh));
+	memcpy(model.meshes, meshes.data(), meshes.size() * sizeof(Mesh));
+
+	model.materialCount = 1;
+	model.materials = (Material*)MemAlloc(sizeof(Material));
+	model.materials[0] = LoadMaterialDefault();
+	model.materials[0].shader = shader;
+
+	model.meshMaterial = (int*)MemAlloc(meshes.size() * sizeof(int));
+
+	return true;
+}
+
+// As UploadMesh, with the arrays of VERTEX_QUANTIZED as vertex attributes the shader reads as floats:
+// positions 0 to 1 across the bounds, uvs as they are and normals 0 to 1 on the octahedron.
+// The indices stay on the mesh, DrawMesh draws with them when they are there.
+void UploadQuantizedMesh(Mesh* mesh, const void* posXYZ, const void* UV, const void* norXY)
+{
+	mesh->vboId = (unsigned int*)MemAlloc(MESH_VERTEX_BUFFERS * sizeof(unsigned int));
+
+	mesh->vaoId = rlLoadVertexArray();
+	rlEnableVertexArray(mesh->vaoId);
+
+	// Position, 4 components with the padding so every vertex starts 4 byte aligned, the shader takes 3
+	mesh->vboId[0] = rlLoadVertexBuffer((void*)posXYZ, mesh->vertexCount * 4 * sizeof(unsigned short), false);
+	rlSetVertexAttribute(0, 3, RL_UNSIGNED_SHORT, true, 4 * sizeof(unsigned short), 0);
+	rlEnableVertexAttribute(0);
+
+	mesh->vboId[1] = rlLoadVertexBuffer((void*)UV, mesh->vertexCount * 2 * sizeof(unsigned short), false);
+	rlSetVertexAttribute(1, 2, RL_HALF_FLOAT, false, 0, 0);
+	rlEnableVertexAttribute(1);
+
+	mesh->vboId[2] = rlLoadVertexBuffer((void*)norXY, mesh->vertexCount * 2 * sizeof(unsigned short), false);
+	rlSetVertexAttribute(2, 2, RL_UNSIGNED_SHORT, true, 0, 0);
+	rlEnableVertexAttribute(2);
+
+	// Default color vertex attribute set to WHITE
+	float value[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	rlSetVertexAttributeDefault(3, value, SHADER_ATTRIB_VEC4, 4);
+	rlDisableVertexAttribute(3);
+
+	mesh->vboId[6] = rlLoadVertexBufferElement(mesh->indices, mesh->triangleCount * 3 * sizeof(unsigned short), false);
+
+	rlDisableVertexArray();
+}
+
+// Writes the positions and normals of a DELTA into the vertex buffers of a model's meshes.
+// Every mesh has its vertices in the order of the message, so the part of a range in a mesh is one run of it.
+// False if the ranges do not add up to delta.rangeVertices, nothing is written then.
+bool ApplyMeshDelta(Model model, const std::vector<int>& vertices, const sMeshDelta& delta, const char* data)
+{
+	std::vector<sVertexRange> ranges(delta.rangeCount);
+	memcpy(ranges.data(), data, sizeof(sVertexRange) * ranges.size());
+
+	size_t deltaVertices = 0;
+
+	for (const sVertexRange& range : ranges)
+	{
+		if (range.count < 0)
+			return false;
+
+		deltaVertices += range.count;
+	}
+
+	if (deltaVertices != (size_t)delta.rangeVertices)
+		return false;
+
+	const bool quantized = (delta.format == VERTEX_QUANTIZED);
+	const size_t posSize = quantized ? sizeof(unsigned short) * 4 : sizeof(float) * 3;
+	const size_t norSize = quantized ? sizeof(unsigned short) * 2 : sizeof(float) * 3;
+
+	const char* positions = data + sizeof(sVertexRange) * ranges.size();
+	const char* normals = positions + posSize * deltaVertices;
+
+	std::vector<char> posStaging;
+	std::vector<char> norStaging;
+
+	size_t rangeStart = 0;	// First vertex of the range in positions and normals
+
+	for (const sVertexRange& range : ranges)
+	{
+		int meshStart = 0;	// First vertex of the mesh in vertices
+
+		for (int m = 0; m < model.meshCount; m++)
+		{
+			Mesh& mesh = model.meshes[m];
+
+			const auto begin = vertices.begin() + meshStart;
+			const auto end = begin + mesh.vertexCount;
+
+			meshStart += mesh.vertexCount;
+
+			const auto first = std::lower_bound(begin, end, range.first);
+			const auto last = std::lower_bound(first, end, range.first + range.count);
+
+			if (first == last)
+				continue;
+
+			const int local = (int)(first - begin);
+			const int count = (int)(last - first);
+
+			posStaging.resize(posSize * count);
+			norStaging.resize(norSize * count);
+
+			for (int v = 0; v < count; v++)
+			{
+				const size_t k = rangeStart + (first[v] - range.first);
+
+				memcpy(posStaging.data() + posSize * v, positions + posSize * k, posSize);
+				memcpy(norStaging.data() + norSize * v, normals + norSize * k, norSize);
+			}
+
+			rlUpdateVertexBuffer(mesh.vboId[0], posStaging.data(), (int)posStaging.size(), (int)(posSize * local));
+			rlUpdateVertexBuffer(mesh.vboId[2], norStaging.data(), (int)norStaging.size(), (int)(norSize * local));
+
+			// raylib's own copy of a float mesh
+			if (mesh.vertices != nullptr)
+				memcpy(mesh.vertices + local * 3, posStaging.data(), posStaging.size());
+
+			if (mesh.normals != nullptr)
+				memcpy(mesh.normals + local * 3, norStaging.data(), norStaging.size());
+		}
+
+		rangeStart += range.count;
+	}
+
+	return true;
+}
+
+// Meshes of a model and its arrays. The material it is drawn with belongs to materialArr and stays.
+void UnloadModelMeshes(Model model)
+{
+	for (int i = 0; i < model.meshCount; i++)
+	{
+		UnloadMesh(model.meshes[i]);
+	}
+
+	MemFree(model.meshes);
+	MemFree(model.materials);
+	MemFree(model.meshMaterial);
+}
+
 //------------------------------------------------------------------------------------------
 // Types and Structures Definition
 //------------------------------------------------------------------------------------------
 
+// Nodes of one type, entry i is entry i of the type's arrays (modelArr etc).
+// Messages find their entry by handle, the uuid is only looked at when a node is added.
+struct NodeTable
+{
+	std::vector<NodeHandle> handle;
+	std::vector<sUuid> uuid;
+	std::vector<int> index;		// Entry of each handle, -1 if there is none
+
+	int find(const NodeHandle node) const
+	{
+		return (node < index.size()) ? index[node] : -1;
+	}
+
+	int find(const sUuid& id) const
+	{
+		for (int i = 0; i < (int)uuid.size(); i++)
+		{
+			if (memcmp(uuid[i].bytes, id.bytes, sizeof(sUuid)) == 0)
+				return i;
+		}
+
+		return -1;
+	}
+
+	// New entry at the end of the arrays
+	int add(const NodeHandle node, const sUuid& id)
+	{
+		handle.push_back(NODE_NONE);
+		uuid.push_back(id);
+
+		rebind((int)handle.size() - 1, node);
+
+		return (int)handle.size() - 1;
+	}
+
+	// Entry i goes by node from now on, e.g. sent again by a new plugin session
+	void rebind(const int i, const NodeHandle node)
+	{
+		if (find(handle[i]) == i)
+			index[handle[i]] = -1;
+
+		if (node >= index.size())
+			index.resize(node + 1, -1);
+
+		index[node] = i;
+		handle[i] = node;
+	}
+
+	// Entries after i move up one, as they do in the arrays
+	void erase(const int i)
+	{
+		if (find(handle[i]) == i)
+			index[handle[i]] = -1;
+
+		handle.erase(handle.begin() + i);
+		uuid.erase(uuid.begin() + i);
+
+		for (int& entry : index)
+		{
+			if (entry > i)
+				entry--;
+		}
+	}
+};
+
 
 int main(void)
 {
@@ -135,452 +520,585 @@ int main(void)
 	float value[4] = { 0.1f, 0.1f, 0.1f, 1.0f };
 	SetShaderValue(shader, ambientLoc, value, SHADER_UNIFORM_VEC4);
 
+	// Set per model, how its vertices are decoded (see VERTEX_QUANTIZED)
+	int quantizedLoc = GetShaderLocation(shader, "quantized");
+	int boundsMinLoc = GetShaderLocation(shader, "boundsMin");
+	int boundsMaxLoc = GetShaderLocation(shader, "boundsMax");
+
 	// Identify/find each node
-	std::vector<std::string> modelID;
-	std::vector<std::string> transformID;
-	std::vector<std::string> materialID;
+	NodeTable models;
+	NodeTable transforms;
+	NodeTable materials;
+	std::vector<NodeHandle> modelMaterial;		// Material of each model, drawn with it once it arrives
+	std::vector<sMeshHeader> modelHeader;		// Header each model was loaded from: vertex count, format and bounds
+	std::vector<std::vector<int>> modelVertices;	// Vertex of the message each vertex of each model's meshes is
+	std::vector<int> transformSlot;				// Slot of each transform in stateTable, -1 until found
+	std::vector<unsigned int> transformSequence;	// Last slot sequence applied
 
 	// Store every node
 	std::vector<Model> modelArr;		// cube1, sphere1, cube2, donut1
 	std::vector<Matrix> transformArr;	// cube1T, sphere1T, cube2T, donut1T
 	std::vector<Material> materialArr;	// lambert1, phong2
-	std::vector<int> materialIndexArr;	// 1, 0, 0, 1
 	//std::vector<Camera> cameraArr;	// No need to store/idetify camera as only one needed
+	int cameraSlot = -1;
+	unsigned int cameraSequence = 0;
 
-	Vector3 modelPosition = { 0.0f, 0.0f, 0.0f };
+	// Replies to the plugin, see sFeedback
+	const unsigned int rendererID = std::random_device{}();
+	unsigned int joins = 0;						// comlib.joins() the last hello was sent for
+	int bulkRead = 0;							// Bulk lane messages read and not acked yet
+	std::vector<sNodeRef> missing;				// Nodes to ask the plugin for again
+	auto lastFeedback = std::chrono::steady_clock::now();
 
-	// Using 4 point lights: gold, red, green and blue
-	Light lights[4] = { 0 };
-	lights[0] = CreateLight(LIGHT_POINT, Vector3{ -2, 1, -2 }, Vector3Zero(), YELLOW, shader);
-	lights[1] = CreateLight(LIGHT_POINT, Vector3{ 2, 1, 2 }, Vector3Zero(), RED, shader);
-	lights[2] = CreateLight(LIGHT_POINT, Vector3{ -2, 1, 2 }, Vector3Zero(), GREEN, shader);
-	lights[3] = CreateLight(LIGHT_POINT, Vector3{ 2, 1, -2 }, Vector3Zero(), BLUE, shader);
-
-	SetTargetFPS(60); // Set our game to run at 60 frames-per-second
-
-	// Main game loop
+	std::vector<char> inflated;					// Compressed mesh arrays inflate here, kept between messages
 
-	while (!WindowShouldClose()) // Detect window close button or ESC key
+	// Applies one message to the scene, a message of its own or a record of a PACKET
+	auto applyMessage = [&](const sHeader& msgHead, const char* msgData, const size_t msgSize)
 	{
-		// Shared Memory recv messages
-		//----------------------------------------------------------------------------------
-
-		if (comlib.recv(msg, msgSize)) {
-
-			sHeader msgHead{};
-
-			memcpy(&msgHead, (char*)msg, sizeof(sHeader));
-
-			if (msgHead.type == CAMERA)
+		if (msgHead.type == MESH)
+		{
+			// mesh added
+			if (msgHead.activity == ADD)
 			{
-				//if (DEBUG) std::cout << "UPDATE Camera" << std::endl;
-
-				sCamera msgCam{};
+				if (DEBUG) std::cout << "ADD Mesh [" << msgHead.node << "]" << std::endl;
 
-				memcpy(&msgCam, (char*)msg + sizeof(sHeader), sizeof(sCamera));
+				MessageView<MESH, ADD> message;
 
-				camera.position.x = msgCam.position[0];
-				camera.position.y = msgCam.position[1];
-				camera.position.z = msgCam.position[2];
-				camera.target.x = msgCam.target[0];
-				camera.target.y = msgCam.target[1];
-				camera.target.z = msgCam.target[2];
-				camera.up.x = msgCam.up[0];
-				camera.up.y = msgCam.up[1];
-				camera.up.z = msgCam.up[2];
-				camera.fovy = msgCam.fovy;
-				camera.projection = msgCam.projection;
+				const bool read = decodeMessage(msgData, msgSize, message);
+				const sMeshHeader& meshHeader = message.fixed;
+				const sUuid& uuid = message.uuid;
+				const char* arrays = read ? ReadMeshArrays(meshHeader, message.variable, inflated) : nullptr;
 
-			}
+				std::vector<int> tempVertices;
+				Model tempModel{};
 
-			if (msgHead.type == MESH)
-			{
-				// mesh added
-				if (msgHead.activity == ADD)
+				// Damaged on the way, ask for it again
+				if (arrays == nullptr || !LoadIndexedModel(meshHeader, arrays, shader, tempModel, tempVertices))
 				{
-					if (DEBUG) std::cout << "ADD Mesh [" << msgHead.nodeID << "]" << std::endl;
+					sNodeRef node{ MESH };
+					node.node = msgHead.node;
+					missing.push_back(node);
+					return;
+				}
 
-					sMeshHeader meshHeader{};
-					sMeshData meshData{};
+				// Already here under another handle, the new mesh takes its place and keeps its transform
+				int i = models.find(uuid);
 
-					int offset = sizeof(sHeader);
+				if (i < 0)
+				{
+					i = models.add(msgHead.node, uuid);
+					modelArr.push_back(tempModel);
+					modelMaterial.push_back(NODE_NONE);
+					modelHeader.push_back(sMeshHeader{});
+					modelVertices.push_back(std::vector<int>());
+				}
+				else
+				{
+					models.rebind(i, msgHead.node);
+					UnloadModelMeshes(modelArr[i]);
+					modelArr[i] = tempModel;
+				}
 
-					memcpy(&meshHeader, (char*)msg + offset, sizeof(sMeshHeader));
-					offset += sizeof(sMeshHeader);
+				modelMaterial[i] = meshHeader.material;
+				modelHeader[i] = meshHeader;
+				modelVertices[i].swap(tempVertices);
 
-					meshData.posXYZ = (float*)MemAlloc(meshHeader.vertexCount * 3 * sizeof(float));
-					memcpy(meshData.posXYZ, (char*)msg + offset, sizeof(float) * meshHeader.vertexCount * 3);
-					offset += sizeof(float) * meshHeader.vertexCount * 3;
+				// Its material was lost on the way, ask for it again
+				if (meshHeader.material != NODE_NONE && materials.find(meshHeader.material) < 0)
+				{
+					sNodeRef node{ MATERIAL };
+					node.node = meshHeader.material;
+					missing.push_back(node);
+				}
 
-					meshData.UV = (float*)MemAlloc(meshHeader.vertexCount * 2 * sizeof(float));
-					memcpy(meshData.UV, (char*)msg + offset, sizeof(float) * meshHeader.vertexCount * 2);
-					offset += sizeof(float) * meshHeader.vertexCount * 2;
+			}
 
-					meshData.norXYZ = (float*)MemAlloc(meshHeader.vertexCount * 3 * sizeof(float));
-					memcpy(meshData.norXYZ, (char*)msg + offset, sizeof(float) * meshHeader.vertexCount * 3);
+			// vtx moved / vertex divide
+			if (msgHead.activity == UPDATE)
+			{
+				const int i = models.find(msgHead.node);
 
-					Mesh tempMesh{};
+				if (i >= 0)
+				{
+					if (DEBUG) std::cout << "UPDATE Mesh [" << msgHead.node << "]" << std::endl;
 
-					tempMesh.vertexCount = meshHeader.vertexCount;
-					tempMesh.triangleCount = meshHeader.triangleCount;
+					MessageView<MESH, UPDATE> message;
 
-					tempMesh.vertices = meshData.posXYZ;
-					tempMesh.texcoords = meshData.UV;
-					tempMesh.normals = meshData.norXYZ;
+					const bool read = decodeMessage(msgData, msgSize, message);
+					const sMeshHeader& meshHeader = message.fixed;
+					const char* arrays = read ? ReadMeshArrays(meshHeader, message.variable, inflated) : nullptr;
 
-					UploadMesh(&tempMesh, false);
+					Model tempModel{};
 
-					Model tempModel = LoadModelFromMesh(tempMesh);
+					// Damaged on the way, the model stays as it was until the mesh comes again
+					if (arrays == nullptr || !LoadIndexedModel(meshHeader, arrays, shader, tempModel, modelVertices.at(i)))
+					{
+						sNodeRef node{ MESH };
+						node.node = msgHead.node;
+						missing.push_back(node);
+						return;
+					}
 
-					tempModel.materials[0] = LoadMaterialDefault();
+					UnloadModelMeshes(modelArr.at(i));
 
-					tempModel.materials[0].shader = shader;
+					modelArr.at(i) = tempModel;
 
-					modelID.push_back(msgHead.nodeID);
-					modelArr.push_back(tempModel);
-					materialIndexArr.push_back(0);
+					// If the material can't be found, then it will be drawn with it when it arrives
+					modelMaterial.at(i) = meshHeader.material;
+					modelHeader.at(i) = meshHeader;
 
-					for (int i = 0; i < materialArr.size(); i++)
+					if (meshHeader.material != NODE_NONE && materials.find(meshHeader.material) < 0)
 					{
-						if (materialID[i] == meshHeader.connectedMatID)
-						{
-							for (int j = 0; j < modelID.size(); j++)
-							{
-								if (msgHead.nodeID == modelID[j])
-								{
-									materialIndexArr[j] = i;
-								}
-							}
-						}
+						sNodeRef node{ MATERIAL };
+						node.node = meshHeader.material;
+						missing.push_back(node);
 					}
-
 				}
+				else
+				{
+					// Its add was lost on the way, ask for the whole mesh
+					sNodeRef node{ MESH };
+					node.node = msgHead.node;
+					missing.push_back(node);
+				}
+			}
 
-				// vtx moved / vertex divide
-				if (msgHead.activity == UPDATE)
+			// vtx moved, same faces: only the vertices that moved
+			if (msgHead.activity == DELTA)
+			{
+				const int i = models.find(msgHead.node);
+
+				MessageView<MESH, DELTA> message;
+
+				const bool read = decodeMessage(msgData, msgSize, message);
+				const sMeshDelta& delta = message.fixed;
+
+				if (!read || i < 0 || delta.vertexCount != modelHeader[i].vertexCount || delta.format != modelHeader[i].format ||
+					!ApplyMeshDelta(modelArr[i], modelVertices[i], delta, message.variable))
 				{
-					for (int i = 0; i < modelID.size(); i++)
-					{
-						if (modelID[i] == msgHead.nodeID)
-						{
-							if (DEBUG) std::cout << "UPDATE Mesh [" << msgHead.nodeID << "]" << std::endl;
+					// Missed the mesh it applies to or damaged on the way, ask for the whole mesh
+					sNodeRef node{ MESH };
+					node.node = msgHead.node;
+					missing.push_back(node);
+				}
+			}
 
-							sMeshHeader meshHeader{};
-							sMeshData meshData{};
+			// material reassigned, nothing else changed
+			if (msgHead.activity == LINK)
+			{
+				const int i = models.find(msgHead.node);
 
-							int offset = sizeof(sHeader);
+				MessageView<MESH, LINK> message;
 
-							memcpy(&meshHeader, (char*)msg + offset, sizeof(sMeshHeader));
-							offset += sizeof(sMeshHeader);
+				const bool read = decodeMessage(msgData, msgSize, message);
+				const NodeHandle material = message.fixed;
 
-							meshData.posXYZ = (float*)MemAlloc(meshHeader.vertexCount * 3 * sizeof(float));
-							memcpy(meshData.posXYZ, (char*)msg + offset, sizeof(float) * meshHeader.vertexCount * 3);
-							offset += sizeof(float) * meshHeader.vertexCount * 3;
+				if (read && i >= 0)
+				{
+					if (DEBUG) std::cout << "LINK Mesh [" << msgHead.node << "] to Material [" << material << "]" << std::endl;
 
-							meshData.UV = (float*)MemAlloc(meshHeader.vertexCount * 2 * sizeof(float));
-							memcpy(meshData.UV, (char*)msg + offset, sizeof(float) * meshHeader.vertexCount * 2);
-							offset += sizeof(float) * meshHeader.vertexCount * 2;
+					modelMaterial[i] = material;
+					modelHeader[i].material = material;
 
-							meshData.norXYZ = (float*)MemAlloc(meshHeader.vertexCount * 3 * sizeof(float));
-							memcpy(meshData.norXYZ, (char*)msg + offset, sizeof(float) * meshHeader.vertexCount * 3);
+					if (material != NODE_NONE && materials.find(material) < 0)
+					{
+						sNodeRef node{ MATERIAL };
+						node.node = material;
+						missing.push_back(node);
+					}
+				}
+				else
+				{
+					sNodeRef node{ MESH };
+					node.node = msgHead.node;
+					missing.push_back(node);
+				}
+			}
 
-							delete[] modelArr.at(i).meshes[0].vertices;
-							delete[] modelArr.at(i).meshes[0].texcoords;
-							delete[] modelArr.at(i).meshes[0].normals;
+			// mesh removed
+			if (msgHead.activity == REMOVE)
+			{
+				const int i = models.find(msgHead.node);
 
-							Mesh tempMesh = {};
+				if (i >= 0)
+				{
+					if (DEBUG) std::cout << "REMOVE Mesh [" << msgHead.node << "]" << std::endl;
+					UnloadModelMeshes(modelArr[i]);
+					modelArr.erase(modelArr.begin() + i);
+					modelMaterial.erase(modelMaterial.begin() + i);
+					modelHeader.erase(modelHeader.begin() + i);
+					modelVertices.erase(modelVertices.begin() + i);
+					models.erase(i);
+				}
+			}
 
-							tempMesh.vertexCount = meshHeader.vertexCount;
-							tempMesh.triangleCount = meshHeader.triangleCount;
+		}
 
-							tempMesh.vertices = meshData.posXYZ;
-							tempMesh.texcoords = meshData.UV;
-							tempMesh.normals = meshData.norXYZ;
+		// Over a socket, or replayed from a log, camera and transforms come as messages. Kept in the table all the same.
+		if (msgHead.type == TRANSFORM && msgHead.activity == UPDATE)
+		{
+			MessageView<TRANSFORM, UPDATE> message;
 
-							UploadMesh(&tempMesh, false);
+			if (decodeMessage(msgData, msgSize, message))
+				stateTable.write(msgHead.node, &message.fixed, sizeof(sTransform));
+		}
 
-							modelArr.at(i) = LoadModelFromMesh(tempMesh);
-							modelArr.at(i).materials[0].shader = shader;
+		if (msgHead.type == CAMERA && msgHead.activity == UPDATE)
+		{
+			MessageView<CAMERA, UPDATE> message;
 
-							bool foundMat = false;
-							for (int j = 0; j < materialArr.size(); j++)
-							{
-								if (materialID[j] == meshHeader.connectedMatID)
-								{
-									materialIndexArr.at(i) = j;
-									foundMat = true;
-								}
-							}
-							// If connectedMatID can't be found, then it will be pushed-back later
-							if (!foundMat)
-							{
-								materialIndexArr.at(i) = materialArr.size();
-							}
+			if (decodeMessage(msgData, msgSize, message))
+				stateTable.write(STATE_CAMERA, &message.fixed, sizeof(sCamera));
+		}
 
-						}
-					}
+		if (msgHead.type == TRANSFORM)
+		{
+			// transform added
+			if (msgHead.activity == ADD)
+			{
+				if (DEBUG) std::cout << "ADD Transform [" << msgHead.node << "]" << std::endl;
+
+				MessageView<TRANSFORM, ADD> message;
+
+				if (!decodeMessage(msgData, msgSize, message))
+					return;
+
+				const sTransform& transform = message.fixed;
+				const sUuid& uuid = message.uuid;
+
+				Matrix tempMatrix;
+
+				tempMatrix.m0 = transform.m0;
+				tempMatrix.m1 = transform.m1;
+				tempMatrix.m2 = transform.m2;
+				tempMatrix.m3 = transform.m3;
+				tempMatrix.m4 = transform.m4;
+				tempMatrix.m5 = transform.m5;
+				tempMatrix.m6 = transform.m6;
+				tempMatrix.m7 = transform.m7;
+				tempMatrix.m8 = transform.m8;
+				tempMatrix.m9 = transform.m9;
+				tempMatrix.m10 = transform.m10;
+				tempMatrix.m11 = transform.m11;
+				tempMatrix.m12 = transform.m12;
+				tempMatrix.m13 = transform.m13;
+				tempMatrix.m14 = transform.m14;
+				tempMatrix.m15 = transform.m15;
+
+				// Already here under another handle, its slot is now tagged with the new one
+				int i = transforms.find(uuid);
+
+				if (i < 0)
+				{
+					i = transforms.add(msgHead.node, uuid);
+					transformArr.push_back(tempMatrix);
+					transformSlot.push_back(-1);
+					transformSequence.push_back(0);
 				}
-
-				// mesh removed
-				if (msgHead.activity == REMOVE)
+				else
 				{
-					for (int i = 0; i < modelID.size(); i++)
-					{
-						if (modelID[i] == msgHead.nodeID)
-						{
-							if (DEBUG) std::cout << "REMOVE Mesh [" << msgHead.nodeID << "]" << std::endl;
-							modelArr.erase(modelArr.begin() + i);
-							modelID.erase(modelID.begin() + i);
-							materialIndexArr.erase(materialIndexArr.begin() + i);
-						}
-					}
+					transforms.rebind(i, msgHead.node);
+					transformArr[i] = tempMatrix;
 				}
 
+				transformSlot[i] = stateTable.find(msgHead.node);
+				transformSequence[i] = 0;
+
 			}
 
-			if (msgHead.type == TRANSFORM)
+			// transform removed
+			if (msgHead.activity == REMOVE)
 			{
-				// transform added
-				if (msgHead.activity == ADD)
+				const int i = transforms.find(msgHead.node);
+
+				if (i >= 0)
 				{
-					if (DEBUG) std::cout << "ADD Transform [" << msgHead.nodeID << "]" << std::endl;
+					if (DEBUG) std::cout << "REMOVE Transform [" << msgHead.node << "]" << std::endl;
+					transformArr.erase(transformArr.begin() + i);
+					transformSlot.erase(transformSlot.begin() + i);
+					transformSequence.erase(transformSequence.begin() + i);
+					transforms.erase(i);
+				}
+
+				// The plugin owns the table over shared memory
+				if (!comlib.shared())
+					stateTable.erase(msgHead.node);
+			}
+		}
 
+		if (msgHead.type == MATERIAL)
+		{
+			sMaterial smaterial{};
+			sUuid uuid{};
+			const char* texturePath = "";	// Read in place, '\0' included
 
-					transformID.push_back(msgHead.nodeID);
+			// An add and an update carry the same struct and path (MaterialSpec)
+			auto read = [&](auto& message)
+			{
+				if (!decodeMessage(msgData, msgSize, message))
+					return false;
 
-					sTransform transform{};
+				smaterial = message.fixed;
+				uuid = message.uuid;
 
-					int offset = sizeof(sHeader);
+				if (smaterial.pathSize > 0)
+					texturePath = message.variable;
 
-					memcpy(&transform, (char*)msg + offset, sizeof(sTransform));
+				return smaterial.pathSize == 0 || texturePath[smaterial.pathSize - 1] == '\0';
+			};
 
-					Matrix tempMatrix;
+			MessageView<MATERIAL, ADD> added;
+			MessageView<MATERIAL, UPDATE> updated;
 
-					tempMatrix.m0 = transform.m0;
-					tempMatrix.m1 = transform.m1;
-					tempMatrix.m2 = transform.m2;
-					tempMatrix.m3 = transform.m3;
-					tempMatrix.m4 = transform.m4;
-					tempMatrix.m5 = transform.m5;
-					tempMatrix.m6 = transform.m6;
-					tempMatrix.m7 = transform.m7;
-					tempMatrix.m8 = transform.m8;
-					tempMatrix.m9 = transform.m9;
-					tempMatrix.m10 = transform.m10;
-					tempMatrix.m11 = transform.m11;
-					tempMatrix.m12 = transform.m12;
-					tempMatrix.m13 = transform.m13;
-					tempMatrix.m14 = transform.m14;
-					tempMatrix.m15 = transform.m15;
+			if ((msgHead.activity == ADD && !read(added)) || (msgHead.activity == UPDATE && !read(updated)))
+				return;
 
-					transformArr.push_back(tempMatrix);
+			// material added
+			if (msgHead.activity == ADD)
+			{
+				// Already here under another handle, e.g. lambert1 sent again by a new plugin session
+				const int i = materials.find(uuid);
 
+				if (i >= 0)
+				{
+					materials.rebind(i, msgHead.node);
 				}
-
-				// transform moved
-				if (msgHead.activity == UPDATE)
+				else
 				{
-					// Maybe can just memcpy Matrix directly
-					for (int i = 0; i < transformID.size(); i++)
+					if (DEBUG) std::cout << "NEW Material [" << msgHead.node << "]" << std::endl;
+
+					Material tempMaterial = LoadMaterialDefault();
+					tempMaterial.shader = shader;
+
+					// Color
+					tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.r = smaterial.color[0] * 255;
+					tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.g = smaterial.color[1] * 255;
+					tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.b = smaterial.color[2] * 255;
+
+					// Texture
+					if (smaterial.pathSize > 0)
 					{
-						if (transformID[i] == msgHead.nodeID)
-						{
-							if (DEBUG) std::cout << "UPDATE Transform [" << msgHead.nodeID << "]" << std::endl;
-
-							sTransform transform{};
-
-							int offset = sizeof(sHeader);
-
-							memcpy(&transform, (char*)msg + offset, sizeof(sTransform));
-
-							transformArr[i].m0 = transform.m0;
-							transformArr[i].m1 = transform.m1;
-							transformArr[i].m2 = transform.m2;
-							transformArr[i].m3 = transform.m3;
-							transformArr[i].m4 = transform.m4;
-							transformArr[i].m5 = transform.m5;
-							transformArr[i].m6 = transform.m6;
-							transformArr[i].m7 = transform.m7;
-							transformArr[i].m8 = transform.m8;
-							transformArr[i].m9 = transform.m9;
-							transformArr[i].m10 = transform.m10;
-							transformArr[i].m11 = transform.m11;
-							transformArr[i].m12 = transform.m12;
-							transformArr[i].m13 = transform.m13;
-							transformArr[i].m14 = transform.m14;
-							transformArr[i].m15 = transform.m15;
-						}
+						tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.r = 255;
+						tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.g = 255;
+						tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.b = 255;
+
+						std::cout << texturePath << std::endl;
+						Texture2D texture = LoadTexture(texturePath);
+						tempMaterial.maps[MATERIAL_MAP_DIFFUSE].texture = texture;
 					}
+
+					// Pushback into vector array, models that arrived before it find it by handle
+					materials.add(msgHead.node, uuid);
+					materialArr.push_back(tempMaterial);
 				}
 
-				// transform removed
-				if (msgHead.activity == REMOVE)
+			}
+
+			// material changed color / texture
+			if (msgHead.activity == UPDATE)
+			{
+				const int i = materials.find(msgHead.node);
+
+				if (i >= 0)
 				{
-					for (int i = 0; i < transformID.size(); i++)
+					if (DEBUG) std::cout << "UPDATE Material [" << msgHead.node << "]" << std::endl;
+					// Color
+					materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.r = smaterial.color[0] * 255;
+					materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.g = smaterial.color[1] * 255;
+					materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.b = smaterial.color[2] * 255;
+
+					//UnloadTexture(materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].texture);
+					// Texture
+					if (smaterial.pathSize > 0)
 					{
-						if (transformID[i] == msgHead.nodeID)
-						{
-							if (DEBUG) std::cout << "REMOVE Transform [" << msgHead.nodeID << "]" << std::endl;
-							transformArr.erase(transformArr.begin() + i);
-							transformID.erase(transformID.begin() + i);
-						}
+						materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.r = 255;
+						materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.g = 255;
+						materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.b = 255;
+
+						std::cout << texturePath << std::endl;
+						Texture2D texture = LoadTexture(texturePath);
+						materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].texture = texture;
 					}
 				}
+				else
+				{
+					// An update only has the handle, ask for the whole material
+					sNodeRef node{ MATERIAL };
+					node.node = msgHead.node;
+					missing.push_back(node);
+				}
+
 			}
 
-			if (msgHead.type == MATERIAL)
+			// material removed
+			if (msgHead.activity == REMOVE)
 			{
-				// material added
-				if (msgHead.activity == ADD)
-				{
-					//Material material;
+				const int i = materials.find(msgHead.node);
 
-					sMaterial smaterial{};
+				if (i >= 0)
+				{
+					if (DEBUG) std::cout << "REMOVE Material [" << msgHead.node << "]" << std::endl;
+					materialArr.erase(materialArr.begin() + i);
+					materials.erase(i);
+				}
+			}
+		}
+	};
 
-					int offset = sizeof(sHeader);
+	Vector3 modelPosition = { 0.0f, 0.0f, 0.0f };
 
-					memcpy(&smaterial, (char*)msg + offset, sizeof(sMaterial));
-					offset += sizeof(sMaterial);
+	// Using 4 point lights: gold, red, green and blue
+	Light lights[4] = { 0 };
+	lights[0] = CreateLight(LIGHT_POINT, Vector3{ -2, 1, -2 }, Vector3Zero(), YELLOW, shader);
+	lights[1] = CreateLight(LIGHT_POINT, Vector3{ 2, 1, 2 }, Vector3Zero(), RED, shader);
+	lights[2] = CreateLight(LIGHT_POINT, Vector3{ -2, 1, 2 }, Vector3Zero(), GREEN, shader);
+	lights[3] = CreateLight(LIGHT_POINT, Vector3{ 2, 1, -2 }, Vector3Zero(), BLUE, shader);
 
-					smaterial.texturePath = new char[smaterial.pathSize];
-					memcpy(smaterial.texturePath, (char*)msg + offset, sizeof(char) * smaterial.pathSize);
+	SetTargetFPS(60); // Set our game to run at 60 frames-per-second
 
-					Material tempMaterial = LoadMaterialDefault();
-					tempMaterial.shader = shader;
+	// Main game loop
 
-					bool duplicate = false;
+	while (!WindowShouldClose()) // Detect window close button or ESC key
+	{
+		// Shared Memory recv messages
+		//----------------------------------------------------------------------------------
 
-					for (int i = 0; i < materialID.size(); i++)
-					{
-						if (materialID[i] == msgHead.nodeID)
-						{
+		// Drain everything pending instead of one message per frame
+		// Each message is handled in place in the shared buffer and released afterwards
+		const char* msgData = nullptr;
+		size_t msgCount = 0;
+		unsigned int msgLane = 0;
 
-							// Pushback the existing material index
-							duplicate = true;
-						}
-					}
+		while (msgCount < MSGBATCH && (msgData = comlib.peek(msgSize, &msgLane)) != nullptr) {
 
-					if (!duplicate)
-					{
-						if (DEBUG) std::cout << "NEW Material [" << msgHead.nodeID << "]" << std::endl;
-
-						// Color
-						tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.r = smaterial.color[0] * 255;
-						tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.g = smaterial.color[1] * 255;
-						tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.b = smaterial.color[2] * 255;
-
-						// Texture
-						if (smaterial.pathSize > 0)
-						{
-							tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.r = 255;
-							tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.g = 255;
-							tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.b = 255;
-
-							std::cout << smaterial.texturePath << std::endl;
-							Texture2D texture = LoadTexture(smaterial.texturePath);
-							tempMaterial.maps[MATERIAL_MAP_DIFFUSE].texture = texture;
-						}
-
-						// Pushback into vector array
-						materialID.push_back(msgHead.nodeID);
-						materialArr.push_back(tempMaterial);
-					}
+			sHeader msgHead{};
 
-				}
+			memcpy(&msgHead, (char*)msgData, sizeof(sHeader));
 
-				// material changed color / texture
-				if (msgHead.activity == UPDATE)
-				{
+			// Written by a plugin or a log of another wire format, its structs can not be read
+			if (msgHead.version != SCHEMA_VERSION)
+			{
+				if (DEBUG) std::cout << "SKIP message of schema version " << msgHead.version << std::endl;
 
-					sMaterial smaterial{};
+				if (msgLane == LANE_BULK)
+					bulkRead++;
 
-					int offset = sizeof(sHeader);
+				comlib.release();
+				msgCount++;
+				continue;
+			}
 
-					memcpy(&smaterial, (char*)msg + offset, sizeof(sMaterial));
-					offset += sizeof(sMaterial);
+			// A packet's records one after the other, each as the message it was before it was batched
+			if (msgHead.activity == PACKET)
+			{
+				PacketReader packet(msgData, msgSize);
 
-					smaterial.texturePath = new char[smaterial.pathSize];
-					memcpy(&smaterial.texturePath[0], (char*)msg + offset, smaterial.pathSize);
+				const char* record = nullptr;
+				size_t recordSize = 0;
 
+				while (packet.next(record, recordSize))
+				{
+					sHeader recordHead{};
+					memcpy(&recordHead, record, sizeof(sHeader));
 
-					Material tempMaterial = LoadMaterialDefault();
-					tempMaterial.shader = shader;
+					applyMessage(recordHead, record, recordSize);
+				}
+			}
+			else
+			{
+				applyMessage(msgHead, msgData, msgSize);
+			}
 
-					bool duplicate = false;
+			if (msgLane == LANE_BULK)
+				bulkRead++;
 
-					for (int i = 0; i < materialID.size(); i++)
-					{
-						if (materialID[i] == msgHead.nodeID)
-						{
-							if (DEBUG) std::cout << "UPDATE Material [" << msgHead.nodeID << "]" << std::endl;
-							// Color
-							materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.r = smaterial.color[0] * 255;
-							materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.g = smaterial.color[1] * 255;
-							materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.b = smaterial.color[2] * 255;
-
-							//UnloadTexture(materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].texture);
-							// Texture
-							if (smaterial.pathSize > 0)
-							{
-								materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.r = 255;
-								materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.g = 255;
-								materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].color.b = 255;
-
-								std::cout << smaterial.texturePath << std::endl;
-								Texture2D texture = LoadTexture(smaterial.texturePath);
-								materialArr.at(i).maps[MATERIAL_MAP_DIFFUSE].texture = texture;
-							}
-
-							duplicate = true;
-						}
-					}
+			comlib.release();
+			msgCount++;
+		}
 
-					if (!duplicate)
-					{
-						if (DEBUG) std::cout << "NEW Material [" << msgHead.nodeID << "]" << std::endl;
-
-						// Color
-						tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.r = smaterial.color[0] * 255;
-						tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.g = smaterial.color[1] * 255;
-						tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.b = smaterial.color[2] * 255;
-
-						// Texture
-						if (smaterial.pathSize > 0)
-						{
-							tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.r = 255;
-							tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.g = 255;
-							tempMaterial.maps[MATERIAL_MAP_DIFFUSE].color.b = 255;
-
-							std::cout << smaterial.texturePath << std::endl;
-							Texture2D texture = LoadTexture(smaterial.texturePath);
-							tempMaterial.maps[MATERIAL_MAP_DIFFUSE].texture = texture;
-						}
-
-						// Pushback into vector array
-						materialID.push_back(msgHead.nodeID);
-						materialArr.push_back(tempMaterial);
-					}
+		// Replies to the plugin
+		//----------------------------------------------------------------------------------
 
-					delete[] smaterial.texturePath;
+		const auto now = std::chrono::steady_clock::now();
 
-				}
+		if (comlib.joins() != joins)
+		{
+			// Started reading, or lost messages after falling behind: tell the plugin what is here and it sends the rest
+			std::vector<sNodeRef> nodes;
 
-				// material removed
-				if (msgHead.activity == REMOVE)
+			auto have = [&](const NODETYPE type, const NodeTable& table)
+			{
+				for (int i = 0; i < table.handle.size(); i++)
 				{
-					for (int i = 0; i < materialID.size(); i++)
-					{
-						if (materialID[i] == msgHead.nodeID)
-						{
-							if (DEBUG) std::cout << "REMOVE Material [" << msgHead.nodeID << "]" << std::endl;
-							materialArr.erase(materialArr.begin() + i);
-							materialID.erase(materialID.begin() + i);
-						}
-					}
+					sNodeRef node{ type };
+					node.node = table.handle[i];
+					node.uuid = table.uuid[i];
+					nodes.push_back(node);
 				}
+			};
+
+			have(MESH, models);
+			have(TRANSFORM, transforms);
+			have(MATERIAL, materials);
+
+			if (sendFeedback(HELLO, rendererID, FEEDBACK_WINDOW, nodes))
+			{
+				if (DEBUG) std::cout << "HELLO with " << nodes.size() << " nodes" << std::endl;
+
+				joins = comlib.joins();
+				bulkRead = 0;
+				missing.clear();
+				lastFeedback = now;
+			}
+		}
+		else
+		{
+			if (!missing.empty() && sendFeedback(RESYNC, rendererID, 0, missing))
+				missing.clear();
+
+			// Credits back for what was read, and now and then even without, so the plugin knows this renderer is still here
+			if ((bulkRead > 0 || now - lastFeedback > std::chrono::milliseconds(FEEDBACK_KEEPALIVE_MS)) && sendFeedback(ACK, rendererID, bulkRead, {}))
+			{
+				bulkRead = 0;
+				lastFeedback = now;
 			}
 		}
 
+		// Camera and transforms are not queued, read whatever is newest in their slots
+		//----------------------------------------------------------------------------------
+
+		sCamera stateCam{};
+
+		if (cameraSlot < 0)
+			cameraSlot = stateTable.find(STATE_CAMERA);
+
+		if (stateTable.read(cameraSlot, STATE_CAMERA, &stateCam, sizeof(sCamera), cameraSequence))
+		{
+			camera.position.x = stateCam.position[0];
+			camera.position.y = stateCam.position[1];
+			camera.position.z = stateCam.position[2];
+			camera.target.x = stateCam.target[0];
+			camera.target.y = stateCam.target[1];
+			camera.target.z = stateCam.target[2];
+			camera.up.x = stateCam.up[0];
+			camera.up.y = stateCam.up[1];
+			camera.up.z = stateCam.up[2];
+			camera.fovy = stateCam.fovy;
+			camera.projection = stateCam.projection;
+		}
+
+		for (int i = 0; i < transforms.handle.size(); i++)
+		{
+			if (transformSlot[i] < 0)
+				transformSlot[i] = stateTable.find(transforms.handle[i]);
+
+			sTransform stateTransform{};
+
+			// sTransform has the same layout as Matrix
+			if (stateTable.read(transformSlot[i], transforms.handle[i], &stateTransform, sizeof(sTransform), transformSequence[i]))
+				memcpy(&transformArr[i], &stateTransform, sizeof(sTransform));
+		}
+
 		UpdateCamera(&camera); // Update camera
 
 		// Update light values (actually, only enable/disable them)
@@ -614,14 +1132,17 @@ int main(void)
 				// Material out of range
 			}
 
-			try
-			{
-				modelArr.at(i).materials[0] = materialArr.at(materialIndexArr.at(i));
-			}
-			catch (const std::exception&)
-			{
-				// Material out of range
-			}
+			// Straight from the handle, a material that has not arrived yet leaves the default
+			const int material = materials.find(modelMaterial[i]);
+
+			if (material >= 0)
+				modelArr[i].materials[0] = materialArr[material];
+
+			const int quantized = (modelHeader[i].format == VERTEX_QUANTIZED);
+
+			SetShaderValue(shader, quantizedLoc, &quantized, SHADER_UNIFORM_INT);
+			SetShaderValue(shader, boundsMinLoc, modelHeader[i].boundsMin, SHADER_UNIFORM_VEC3);
+			SetShaderValue(shader, boundsMaxLoc, modelHeader[i].boundsMax, SHADER_UNIFORM_VEC3);
 
 			DrawModel(modelArr[i], {}, 1.0f, color);
 
@@ -0,0 +1,308 @@
+#include "BlobHeap.h"
+#include <chrono>
+#include <thread>
+
+#if defined(_WIN32)
+BlobHeap::BlobHeap(const std::string& secret, const size_t heapSize, const size_t blockSize)
+{
+	const size_t blockCount = (heapSize + blockSize - 1) / blockSize;
+	const size_t bitmapOffset = (sizeof(HeapHeader) + 63) & ~size_t(63);
+	const size_t heapOffset = (bitmapOffset + (blockCount + 63) / 64 * sizeof(unsigned long long) + 63) & ~size_t(63);
+	const size_t fileSize = heapOffset + blockCount * blockSize;
+
+	// Pagefile backed, so the bitmap starts out zeroed: every block free
+	hFileMap = CreateFileMappingA(
+		INVALID_HANDLE_VALUE,
+		NULL,
+		PAGE_READWRITE,
+		(DWORD)((unsigned long long)fileSize >> 32),
+		(DWORD)fileSize,
+		secret.c_str()
+	);
+
+	if (hFileMap == nullptr) {
+		printf("Could not create file mapping object (%d).\n", GetLastError());
+		exit(0);
+	}
+
+	const bool creator = (GetLastError() != ERROR_ALREADY_EXISTS);
+
+	mData = static_cast<char*>(MapViewOfFile(hFileMap, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+
+	if (mData == nullptr) {
+		printf("Could not map view of file (%d).\n", GetLastError());
+		CloseHandle(hFileMap);
+		exit(0);
+	}
+
+	hh = reinterpret_cast<HeapHeader*>(mData);
+	bitmap = reinterpret_cast<std::atomic<unsigned long long>*>(mData + bitmapOffset);
+
+	const auto waitStart = std::chrono::steady_clock::now();
+
+	while (!creator && hh->ready.load(std::memory_order_acquire) == 0 && std::chrono::steady_clock::now() - waitStart < std::chrono::milliseconds(COMLIB_LOCK_TIMEOUT_MS))
+		std::this_thread::yield();
+
+	// A creator that died before writing the header leaves it to this process. The mapping cannot be replaced
+	// while it is open here, but it is as large as this process would have made it.
+	if (!creator && hh->ready.load(std::memory_order_acquire) == 0)
+	{
+		MEMORY_BASIC_INFORMATION region {};
+
+		if (VirtualQuery(mData, &region, sizeof(region)) == 0 || region.RegionSize < fileSize) {
+			printf("Could not finish shared memory object left unfinished (%zu bytes).\n", (size_t)region.RegionSize);
+			UnmapViewOfFile(mData);
+			CloseHandle(hFileMap);
+			exit(0);
+		}
+
+		printf("Finishing shared memory object left unfinished for %d ms.\n", COMLIB_LOCK_TIMEOUT_MS);
+	}
+
+	if (hh->ready.load(std::memory_order_acquire) == 0)
+	{
+		hh->blockSize = blockSize;
+		hh->blockCount = blockCount;
+		hh->heapOffset = heapOffset;
+		hh->ready.store(1, std::memory_order_release);
+	}
+}
+#else
+BlobHeap::BlobHeap(const std::string& secret, const size_t heapSize, const size_t blockSize)
+{
+	const size_t blockCount = (heapSize + blockSize - 1) / blockSize;
+	const size_t bitmapOffset = (sizeof(HeapHeader) + 63) & ~size_t(63);
+	const size_t heapOffset = (bitmapOffset + (blockCount + 63) / 64 * sizeof(unsigned long long) + 63) & ~size_t(63);
+
+	shmName = "/" + secret;
+	mapSize = heapOffset + blockCount * blockSize;
+
+	const size_t fullSize = mapSize;
+	bool creator;
+
+	// A creator that died before its header was ready leaves a segment nobody can attach to, it is replaced
+	for (;;)
+	{
+		creator = true;
+
+		hFileMap = shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+
+		if (hFileMap == -1 && errno == EEXIST) // Another process got there first, attach to its segment
+		{
+			creator = false;
+			hFileMap = shm_open(shmName.c_str(), O_RDWR, 0666);
+		}
+
+		if (hFileMap == -1) {
+			printf("Could not create shared memory object (%d).\n", errno);
+			exit(0);
+		}
+
+		const auto waitStart = std::chrono::steady_clock::now();
+		const auto waited = [&]() { return std::chrono::steady_clock::now() - waitStart > std::chrono::milliseconds(COMLIB_LOCK_TIMEOUT_MS); };
+
+		if (creator)
+		{
+			// ftruncate zeroes the object, so the bitmap starts out with every block free
+			if (ftruncate(hFileMap, (off_t)mapSize) == -1) {
+				printf("Could not size shared memory object (%d).\n", errno);
+				close(hFileMap);
+				shm_unlink(shmName.c_str());
+				exit(0);
+			}
+		}
+		else
+		{
+			// The creator may not have sized the object yet
+			struct stat st {};
+			while (fstat(hFileMap, &st) == 0 && (size_t)st.st_size < bitmapOffset && !waited())
+				sched_yield();
+
+			mapSize = (size_t)st.st_size; // The segment keeps the size chosen by its creator
+		}
+
+		mData = nullptr;
+
+		if (mapSize >= bitmapOffset)
+		{
+			mData = static_cast<char*>(mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, hFileMap, 0));
+
+			if (mData == MAP_FAILED) {
+				printf("Could not map shared memory object (%d).\n", errno);
+				mData = nullptr;
+				close(hFileMap);
+				exit(0);
+			}
+
+			hh = reinterpret_cast<HeapHeader*>(mData);
+
+			while (!creator && hh->ready.load(std::memory_order_acquire) == 0 && !waited())
+				sched_yield();
+
+			if (creator || hh->ready.load(std::memory_order_acquire) != 0)
+				break;
+
+			munmap(mData, mapSize);
+		}
+
+		printf("Replacing shared memory object left unfinished for %d ms.\n", COMLIB_LOCK_TIMEOUT_MS);
+		ComLib::unlinkStale(shmName, hFileMap);
+		close(hFileMap);
+
+		mapSize = fullSize;
+	}
+
+	bitmap = reinterpret_cast<std::atomic<unsigned long long>*>(mData + bitmapOffset);
+
+	if (creator)
+	{
+		hh->blockSize = blockSize;
+		hh->blockCount = blockCount;
+		hh->heapOffset = heapOffset;
+		hh->ready.store(1, std::memory_order_release);
+	}
+
+	hh->users.fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
+bool BlobHeap::claim(const size_t first, const size_t count)
+{
+	// Word by word, if another allocator got any of the blocks first everything claimed so far is given back
+	for (size_t block = first; block < first + count; )
+	{
+		const size_t word = block / 64;
+		const size_t bit = block % 64;
+		const size_t bits = (first + count - block < 64 - bit) ? first + count - block : 64 - bit;
+		const unsigned long long mask = ((bits == 64) ? ~0ull : ((1ull << bits) - 1)) << bit;
+
+		unsigned long long expected = bitmap[word].load(std::memory_order_relaxed);
+
+		do
+		{
+			if (expected & mask)
+			{
+				clear(first, block - first);
+				return false;
+			}
+		} while (!bitmap[word].compare_exchange_weak(expected, expected | mask, std::memory_order_acquire, std::memory_order_relaxed));
+
+		block += bits;
+	}
+
+	return true;
+}
+
+void BlobHeap::clear(const size_t first, const size_t count)
+{
+	for (size_t block = first; block < first + count; )
+	{
+		const size_t word = block / 64;
+		const size_t bit = block % 64;
+		const size_t bits = (first + count - block < 64 - bit) ? first + count - block : 64 - bit;
+		const unsigned long long mask = ((bits == 64) ? ~0ull : ((1ull << bits) - 1)) << bit;
+
+		// Release, whatever was read from the blocks is done before the next owner writes them
+		bitmap[word].fetch_and(~mask, std::memory_order_release);
+
+		block += bits;
+	}
+}
+
+BlobHandle BlobHeap::allocate(const size_t length)
+{
+	BlobHandle blob;
+
+	const size_t count = (length + hh->blockSize - 1) / hh->blockSize;
+
+	if (count == 0 || count > hh->blockCount)
+		return blob;
+
+	// Next fit: search from where the last allocation ended, blobs are mostly freed in the order they were made
+	const size_t start = hh->hint.load(std::memory_order_relaxed) % hh->blockCount;
+
+	for (size_t scanned = 0; scanned < hh->blockCount; )
+	{
+		const size_t first = (start + scanned) % hh->blockCount;
+
+		if (first + count > hh->blockCount) // A run does not wrap around the end of the heap
+		{
+			scanned += hh->blockCount - first;
+			continue;
+		}
+
+		// Skip past the last used block in the run before trying to claim it
+		size_t used = first + count;
+
+		for (size_t block = first + count; block > first; block--)
+		{
+			if (bitmap[(block - 1) / 64].load(std::memory_order_relaxed) & (1ull << ((block - 1) % 64)))
+			{
+				used = block - 1;
+				break;
+			}
+		}
+
+		if (used != first + count)
+		{
+			scanned += used - first + 1;
+			continue;
+		}
+
+		if (claim(first, count))
+		{
+			hh->hint.store(first + count, std::memory_order_relaxed);
+
+			blob.offset = first * hh->blockSize;
+			blob.length = length;
+			return blob;
+		}
+
+		scanned++;
+	}
+
+	return blob;
+}
+
+void BlobHeap::free(const BlobHandle& blob)
+{
+	if (blob.length == 0)
+		return;
+
+	clear(blob.offset / hh->blockSize, (blob.length + hh->blockSize - 1) / hh->blockSize);
+}
+
+char* BlobHeap::data(const BlobHandle& blob) const
+{
+	return mData + hh->heapOffset + blob.offset;
+}
+
+const char* BlobHeap::data(const BlobHandle& blob, const size_t length) const
+{
+	const size_t heapSize = hh->blockCount * hh->blockSize;
+
+	if (blob.offset > heapSize || blob.length > heapSize - blob.offset || length > blob.length)
+		return nullptr;
+
+	return data(blob);
+}
+
+#if defined(_WIN32)
+BlobHeap::~BlobHeap()
+{
+	UnmapViewOfFile((LPCVOID)mData);
+	CloseHandle(hFileMap);
+}
+#else
+BlobHeap::~BlobHeap()
+{
+	const bool last = (hh->users.fetch_sub(1, std::memory_order_relaxed) == 1);
+
+	munmap(mData, mapSize);
+	close(hFileMap);
+
+	// Unlike a Win32 mapping, a POSIX object outlives its handles until unlinked
+	if (last)
+		shm_unlink(shmName.c_str());
+}
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+// Same platform headers and windows.h flags as the ring
+#include "ComLib.h"
+
+// Where a blob lives in the heap, small enough to travel through the ring inside a message
+struct BlobHandle
+{
+	size_t offset = 0;	// From the start of the heap
+	size_t length = 0;	// 0 when no blob was allocated
+};
+
+// Shared-memory heap for bulk payloads (vertex arrays), so only a handle has to go through the ring.
+// Space is handed out in whole blocks tracked by a bitmap in the segment, claimed and freed with atomics only.
+// Any process may allocate or free. The writer publishes a blob by sending its handle through ComLib
+// and frees it once ComLib::consumed shows every reader is past that message.
+class BlobHeap
+{
+private:
+#if defined(_WIN32)
+	HANDLE hFileMap;
+#else
+	int hFileMap;			// shm_open file descriptor
+	std::string shmName;	// "/" + secret
+	size_t mapSize;			// Size of the shared memory object
+#endif
+	char* mData;
+
+	struct HeapHeader
+	{
+		std::atomic<unsigned int> ready;	// Set once the creator has written the header
+		std::atomic<unsigned int> users;	// Attached processes, the last one to leave unlinks the segment (POSIX)
+		size_t blockSize;
+		size_t blockCount;
+		size_t heapOffset;					// Start of the first block
+		std::atomic<size_t> hint;			// Block after the last allocation, where the next search starts
+	};
+
+	HeapHeader* hh;
+	std::atomic<unsigned long long>* bitmap;	// One bit per block, set while it is allocated
+
+	bool claim(const size_t first, const size_t count);
+	void clear(const size_t first, const size_t count);
+
+public:
+	// heapSize and blockSize are chosen by the process that creates the segment, later processes follow it
+	BlobHeap(const std::string& secret, const size_t heapSize, const size_t blockSize);
+
+	// Returns a handle with length 0 if there is no run of free blocks large enough
+	BlobHandle allocate(const size_t length);
+	void free(const BlobHandle& blob);
+
+	char* data(const BlobHandle& blob) const;
+
+	// Reader: data() of a blob from another process, nullptr unless it lies inside the heap and holds length bytes
+	const char* data(const BlobHandle& blob, const size_t length) const;
+
+	~BlobHeap();
+};
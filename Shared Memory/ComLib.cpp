@@ -1,8 +1,24 @@
 #include "ComLib.h"
+#include <new>
+#include <chrono>
+#include <thread>
+#include <algorithm>
 
-ComLib::ComLib(const std::string& secret, const size_t& buffSize)
+#if defined(_WIN32)
+ComLib::ComLib(const std::string& secret, const size_t& buffSize, const MODE mode, const bool mirrored, const unsigned int laneCount, const unsigned int generation)
 {
-	hMutex = CreateMutex(nullptr, false, L"ComLibMutex");
+	// A mirrored buffer is mapped twice back-to-back, every view must start on an allocation granularity boundary
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const size_t granularity = info.dwAllocationGranularity;
+
+	const size_t bufferOffset = mirrored ? (sizeof(SharedHeader) + granularity - 1) / granularity * granularity : (sizeof(SharedHeader) + 63) & ~size_t(63);
+	const size_t bufferSize = mirrored ? (buffSize + granularity - 1) / granularity * granularity : (buffSize + 63) & ~size_t(63);
+	const unsigned int lanesUsed = clampLanes(laneCount);
+	const size_t fileSize = bufferOffset + lanesUsed * bufferSize;
+
+	// One mutex per segment, so separate ComLib channels never contend with each other
+	hMutex = CreateMutexA(nullptr, false, (secret + "Mutex").c_str());
 
 	if (hMutex == NULL)
 	{
@@ -10,14 +26,14 @@ ComLib::ComLib(const std::string& secret, const size_t& buffSize)
 		exit(0);
 	}
 
-	WaitForSingleObject(hMutex, INFINITE); // Lock
+	WaitForSingleObject(hMutex, INFINITE); // Lock, returns WAIT_ABANDONED instead of hanging if the owner died
 
 	hFileMap = CreateFileMappingA(
 		INVALID_HANDLE_VALUE,
 		NULL,
 		PAGE_READWRITE,
-		0,
-		(DWORD)buffSize + sizeof(SharedHeader), // The given buffer size + the size of the shared header
+		(DWORD)((unsigned long long)fileSize >> 32),
+		(DWORD)fileSize, // The given buffer size for each lane + the size of the shared header
 		secret.c_str()
 	);
 
@@ -26,6 +42,9 @@ ComLib::ComLib(const std::string& secret, const size_t& buffSize)
 		exit(0);
 	}
 
+	const bool creator = (GetLastError() != ERROR_ALREADY_EXISTS);
+	created = creator;
+
 	mData = static_cast<char*>(MapViewOfFile(
 		hFileMap,
 		FILE_MAP_ALL_ACCESS,
@@ -40,180 +59,1693 @@ ComLib::ComLib(const std::string& secret, const size_t& buffSize)
 		exit(0);
 	}
 
-	if (GetLastError() != ERROR_ALREADY_EXISTS)
+	sh = reinterpret_cast<SharedHeader*>(mData);
+
+	if (creator)
 	{
-		SharedHeader init_sh;
-		init_sh.offset_head = 0;
-		init_sh.offset_tail = 0;
-		init_sh.freespace = buffSize;
-		init_sh.cBuffer = sizeof(SharedHeader);
-		init_sh.cBufferSize = buffSize;
+		initHeader(bufferOffset, bufferSize, mode, mirrored, lanesUsed, generation);
+	}
 
-		memcpy(mData, &init_sh, sizeof(init_sh));
+	if (sh->mirrored && !mapMirror())
+	{
+		printf("Could not map mirrored view of file (%d).\n", GetLastError());
+		CloseHandle(hFileMap);
+		exit(0);
 	}
-	
+
+	mapLanes();
+
 	ReleaseMutex(hMutex); // Unlock
 
 }
-
-bool ComLib::send(const void* msg, const size_t length)
+#else
+ComLib::ComLib(const std::string& secret, const size_t& buffSize, const MODE mode, const bool mirrored, const unsigned int laneCount, const unsigned int generation)
 {
-	if (mData == nullptr) { // Check if MapViewOfFile has unmapped and closed the handler
-		printf("Map view doesnt exist (%d).\n", GetLastError());
+	// Layout: [SharedHeader][SharedMutex][lane 0 circular buffer][lane 1 circular buffer]...
+	// A mirrored buffer is mapped twice back-to-back, so it has to start and end on a page boundary
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t alignment = mirrored ? page : 64;
+
+	const size_t mutexOffset = (sizeof(SharedHeader) + 63) & ~size_t(63);
+	const size_t bufferOffset = (mutexOffset + sizeof(SharedMutex) + alignment - 1) / alignment * alignment;
+	const size_t bufferSize = (buffSize + alignment - 1) / alignment * alignment;
+	const unsigned int lanesUsed = clampLanes(laneCount);
+
+	shmName = "/" + secret;
+	mapSize = bufferOffset + lanesUsed * bufferSize;
+	viewSize = mapSize;
+
+	bool creator;
+	SharedMutex* sm;
+
+	// A creator that died before its header was ready leaves a segment nobody can attach to, it is replaced
+	for (;;)
+	{
+		creator = true;
+
+		hFileMap = shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+
+		if (hFileMap == -1 && errno == EEXIST) // Another process got there first, attach to its segment
+		{
+			creator = false;
+			hFileMap = shm_open(shmName.c_str(), O_RDWR, 0666);
+		}
+
+		if (hFileMap == -1) {
+			printf("Could not create shared memory object (%d).\n", errno);
+			exit(0);
+		}
+
+		const auto waitStart = std::chrono::steady_clock::now();
+		const auto waited = [&]() { return std::chrono::steady_clock::now() - waitStart > std::chrono::milliseconds(COMLIB_LOCK_TIMEOUT_MS); };
+
+		if (creator)
+		{
+			if (ftruncate(hFileMap, (off_t)mapSize) == -1) {
+				printf("Could not size shared memory object (%d).\n", errno);
+				close(hFileMap);
+				shm_unlink(shmName.c_str());
+				exit(0);
+			}
+		}
+		else
+		{
+			// The creator may not have sized the object yet
+			struct stat st {};
+			while (fstat(hFileMap, &st) == 0 && (size_t)st.st_size < bufferOffset && !waited())
+				sched_yield();
+
+			mapSize = (size_t)st.st_size; // The segment keeps the size chosen by its creator
+			viewSize = mapSize;
+		}
+
+		mData = nullptr;
+
+		if (mapSize >= bufferOffset)
+		{
+			mData = static_cast<char*>(mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, hFileMap, 0));
+
+			if (mData == MAP_FAILED) {
+				printf("Could not map shared memory object (%d).\n", errno);
+				mData = nullptr;
+				close(hFileMap);
+				exit(0);
+			}
+
+			sm = reinterpret_cast<SharedMutex*>(mData + mutexOffset);
+
+			while (!creator && sm->ready.load(std::memory_order_acquire) == 0 && !waited())
+				sched_yield();
+
+			if (creator || sm->ready.load(std::memory_order_acquire) != 0)
+				break;
+
+			munmap(mData, mapSize);
+		}
+
+		printf("Replacing shared memory object left unfinished for %d ms.\n", COMLIB_LOCK_TIMEOUT_MS);
+		unlinkStale(shmName, hFileMap);
+		close(hFileMap);
+
+		mapSize = bufferOffset + lanesUsed * bufferSize;
+		viewSize = mapSize;
+	}
+
+	created = creator;
+
+	sh = reinterpret_cast<SharedHeader*>(mData);
+	hMutex = &sm->mutex;
+
+	if (creator)
+	{
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST); // A crashed peer must not leave the mutex locked forever
+		pthread_mutex_init(hMutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+
+		initHeader(bufferOffset, bufferSize, mode, mirrored, lanesUsed, generation);
+
+		sm->users = 0;
+		sm->ready.store(1, std::memory_order_release);
+	}
+
+	if (sh->mirrored && !mapMirror())
+	{
+		printf("Could not map mirrored shared memory object (%d).\n", errno);
+		munmap(mData, viewSize);
+		close(hFileMap);
 		exit(0);
 	}
 
-	WaitForSingleObject(hMutex, INFINITE); // Lock
+	mapLanes();
+
+	sm = reinterpret_cast<SharedMutex*>(hMutex);
+
+	if (pthread_mutex_lock(hMutex) == EOWNERDEAD)
+		pthread_mutex_consistent(hMutex);
+	sm->users++;
+	pthread_mutex_unlock(hMutex);
+}
+#endif
+
+ComLib::ComLib(const std::string& secret, const size_t& buffSize, const MODE mode, const bool mirrored, const unsigned int laneCount)
+	: ComLib(secret, buffSize, mode, mirrored, laneCount, 0)
+{
+	name = secret;
 
-	bool send = false;
+	// The segment was resized before this process came, go straight to the generation in use
+	const unsigned int latest = sh->latest.load(std::memory_order_acquire);
 
-	// Declared ShareHeader in ComLib.h
-	// ShareHeader sh;
+	if (latest != 0)
+		adopt(attachGeneration(latest, lanes[0].lh->cBufferSize));
+}
 
-	memcpy(&sh, mData, sizeof(sh));
+unsigned int ComLib::clampLanes(const unsigned int laneCount)
+{
+	if (laneCount < 1)
+		return 1;
 
-	// Declared MsgHeader in ComLib.h
-	// MsgHeader mh;
+	return (laneCount > COMLIB_MAX_LANES) ? COMLIB_MAX_LANES : laneCount;
+}
 
-	mh.id = 1;
-	mh.msgLength = length;
-	mh.pad = (64 - (length + sizeof(MsgHeader)) % 64);
-	mh.totalSize = sizeof(MsgHeader) + mh.msgLength + mh.pad;
+void ComLib::initHeader(const size_t bufferOffset, const size_t bufferSize, const MODE mode, const bool mirrored, const unsigned int laneCount, const unsigned int generation)
+{
+	SharedHeader* init_sh = new (mData) SharedHeader;
+	init_sh->mode = mode;
+	init_sh->mirrored = mirrored;
+	init_sh->laneCount = laneCount;
+	init_sh->generation = generation;
+	init_sh->successor.store(0, std::memory_order_relaxed);
+	init_sh->latest.store(0, std::memory_order_relaxed);
 
-	if (mh.totalSize <= sh.freespace && mh.totalSize < (sh.cBufferSize / 2)) // Is there is freespace for the incomming message AND if the message size is less than half of the shared memory size
+	// Lanes are laid out back-to-back after the header, all of the same size
+	for (unsigned int i = 0; i < laneCount; i++)
 	{
+		LaneHeader& lh = init_sh->lanes[i];
+		lh.head.store(0, std::memory_order_relaxed);
+		lh.reserved.store(0, std::memory_order_relaxed);
+		lh.tail.store(0, std::memory_order_relaxed);
+		lh.fragmentSequence.store(0, std::memory_order_relaxed);
+		lh.fragmenting.store(0, std::memory_order_relaxed);
+		lh.skipping.store(0, std::memory_order_relaxed);
+		lh.cBuffer = bufferOffset + i * bufferSize;
+		lh.cBufferSize = bufferSize;
+		lh.first = 0;
 
-		memcpy(mData + sh.cBuffer + sh.offset_head, &mh, sizeof(mh)); // Copy message header to head location
+		for (unsigned int r = 0; r < COMLIB_MAX_READERS; r++)
+			lh.readers[r].tail.store(0, std::memory_order_relaxed);
 
-		sh.freespace -= mh.totalSize; // Remove the incomming message size from freespace
+		std::atomic<unsigned long long>* counters[] = {
+			&lh.counters.sent, &lh.counters.sentBytes, &lh.counters.failedSends, &lh.counters.fragments, &lh.counters.wraps,
+			&lh.counters.sendStallNs, &lh.counters.highWater, &lh.counters.received, &lh.counters.receivedBytes
+		};
 
-		if ((sh.offset_head + mh.totalSize) > sh.cBufferSize) // If msg lenght extends beyond buffer limit, then split the message
-		{
-			
-			size_t msgSize_seg = sh.cBufferSize - (sh.offset_head + sizeof(mh));
-			size_t remainder = mh.msgLength - msgSize_seg;
+		for (std::atomic<unsigned long long>* counter : counters)
+			counter->store(0, std::memory_order_relaxed);
+	}
 
-			sh.offset_head += sizeof(mh);
-			memcpy(mData + sh.cBuffer + sh.offset_head, (char*)msg, msgSize_seg); // Copy first message segment to memory
+	for (unsigned int r = 0; r < COMLIB_MAX_READERS; r++)
+		init_sh->readers[r].store(FREE, std::memory_order_relaxed);
 
-			sh.offset_head = 0; // Put the head at the beginning of the circular buffer
-			memcpy(mData + sh.cBuffer + sh.offset_head, ((char*)msg + msgSize_seg), remainder); // Copy remainder of the message
+	init_sh->lockWaits.store(0, std::memory_order_relaxed);
+	init_sh->lockWaitNs.store(0, std::memory_order_relaxed);
+	init_sh->lockTimeouts.store(0, std::memory_order_relaxed);
+	init_sh->readersDropped.store(0, std::memory_order_relaxed);
+}
 
-			sh.offset_head += remainder + mh.pad;
-		}
-		else // Else write to memory as normal
+void ComLib::mapLanes()
+{
+	lanes.resize(sh->laneCount);
+
+	for (unsigned int i = 0; i < sh->laneCount; i++)
+	{
+		lanes[i].lh = &sh->lanes[i];
+
+		// Mirrored lanes were given their own views by mapMirror
+		if (!sh->mirrored)
+			lanes[i].buffer = mData + sh->lanes[i].cBuffer;
+	}
+}
+
+#if defined(_WIN32)
+bool ComLib::mapMirror()
+{
+	const size_t bufferOffset = sh->lanes[0].cBuffer;
+	const size_t bufferSize = sh->lanes[0].cBufferSize;
+	const unsigned int laneCount = sh->laneCount;
+	const size_t rangeSize = bufferOffset + 2 * laneCount * bufferSize;
+
+	lanes.resize(laneCount);
+
+	// Another thread can take the free address range between VirtualFree and MapViewOfFileEx, so retry a few times
+	for (int attempt = 0; attempt < 16; attempt++)
+	{
+		char* base = static_cast<char*>(VirtualAlloc(nullptr, rangeSize, MEM_RESERVE, PAGE_NOACCESS));
+
+		if (base == nullptr)
+			return false;
+
+		VirtualFree(base, 0, MEM_RELEASE);
+
+		// The header, then every lane buffer followed by a second view of itself
+		std::vector<char*> views;
+		bool mapped = (views.emplace_back(static_cast<char*>(MapViewOfFileEx(hFileMap, FILE_MAP_ALL_ACCESS, 0, 0, bufferOffset, base))) != nullptr);
+
+		for (unsigned int i = 0; mapped && i < laneCount; i++)
 		{
-			
-			sh.offset_head += sizeof(mh);
-			memcpy(mData + sh.cBuffer + sh.offset_head, (char*)msg, mh.msgLength);
+			const size_t fileOffset = sh->lanes[i].cBuffer;
+			char* address = base + bufferOffset + 2 * i * bufferSize;
 
-			sh.offset_head += mh.msgLength + mh.pad;
+			for (int copy = 0; mapped && copy < 2; copy++)
+			{
+				mapped = (views.emplace_back(static_cast<char*>(MapViewOfFileEx(
+					hFileMap,
+					FILE_MAP_ALL_ACCESS,
+					(DWORD)((unsigned long long)fileOffset >> 32),
+					(DWORD)fileOffset,
+					bufferSize,
+					address + copy * bufferSize
+				))) != nullptr);
+			}
 
-			if (sh.cBufferSize <= sh.offset_head)
-				sh.offset_head = 0;
+			lanes[i].buffer = address;
 		}
 
-		send = true;
+		if (!mapped)
+		{
+			for (char* view : views)
+			{
+				if (view != nullptr)
+					UnmapViewOfFile(view);
+			}
+			continue;
+		}
 
-		memcpy(mData, &sh, sizeof(sh)); // Lastly, update share header 
+		UnmapViewOfFile((LPCVOID)mData);
 
+		mData = views[0];
+		mViews = views;
+		sh = reinterpret_cast<SharedHeader*>(mData);
+
+		return true;
 	}
-	
-	ReleaseMutex(hMutex); // Unlock
 
-	return send;
+	return false;
 }
+#else
+bool ComLib::mapMirror()
+{
+	const size_t bufferOffset = sh->lanes[0].cBuffer;
+	const size_t bufferSize = sh->lanes[0].cBufferSize;
+	const unsigned int laneCount = sh->laneCount;
+	const size_t rangeSize = bufferOffset + 2 * laneCount * bufferSize;
+	const size_t mutexOffset = reinterpret_cast<char*>(hMutex) - mData;
 
-bool ComLib::recv(char* msg, size_t& length)
+	lanes.resize(laneCount);
+
+	// Reserve the whole range first so all views land back-to-back
+	char* base = static_cast<char*>(mmap(nullptr, rangeSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+
+	if (base == MAP_FAILED)
+		return false;
+
+	// The header, then every lane buffer followed by a second view of itself
+	bool mapped = (mmap(base, bufferOffset, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, hFileMap, 0) != MAP_FAILED);
+
+	for (unsigned int i = 0; mapped && i < laneCount; i++)
+	{
+		const off_t fileOffset = (off_t)sh->lanes[i].cBuffer;
+		char* address = base + bufferOffset + 2 * i * bufferSize;
+
+		mapped = mmap(address, bufferSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, hFileMap, fileOffset) != MAP_FAILED &&
+			mmap(address + bufferSize, bufferSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, hFileMap, fileOffset) != MAP_FAILED;
+
+		lanes[i].buffer = address;
+	}
+
+	if (!mapped)
+	{
+		munmap(base, rangeSize);
+		return false;
+	}
+
+	munmap(mData, viewSize);
+
+	mData = base;
+	viewSize = rangeSize;
+	sh = reinterpret_cast<SharedHeader*>(mData);
+	hMutex = reinterpret_cast<pthread_mutex_t*>(mData + mutexOffset);
+
+	return true;
+}
+#endif
+
+ComLib::Lane& ComLib::lane(const unsigned int index)
 {
-	if (mData == nullptr) { // Check if other process has unmapped and closed the handler
-		printf("Map view doesnt exist (%d).\n", GetLastError());
-		exit(0);
+	// Segments created with fewer lanes put everything beyond them in the last one
+	return lanes[(index < lanes.size()) ? index : lanes.size() - 1];
+}
+
+ComLib::Lane& ComLib::owner(const char* data)
+{
+	const size_t span = sh->mirrored ? 2 : 1;
+
+	for (Lane& l : lanes)
+	{
+		if (data >= l.buffer && data < l.buffer + span * l.lh->cBufferSize)
+			return l;
 	}
 
-	WaitForSingleObject(hMutex, INFINITE); // Lock
+	return lanes[0];
+}
 
-	bool recv = false;
+bool ComLib::attach()
+{
+	if (reader >= 0)
+	{
+		if (sh->readers[reader].load(std::memory_order_acquire) != DROPPED)
+			return true;
 
-	// Declared ShareHeader in ComLib.h
-	// ShareHeader sh;
+		// Dropped by the producer for holding up the buffer, skip to the newest message and carry on
+		printf("Reader %d was too slow and has been dropped, messages were lost.\n", reader);
 
-	memcpy(&sh, mData, sizeof(sh));
+		for (Lane& l : lanes)
+		{
+			l.reassemblyReady = false;
+			l.reassemblySequence = 0;
+			l.lh->readers[reader].tail.store(l.lh->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+		}
 
-	// Declared MsgHeader in ComLib.h
-	// MsgHeader mh;
+		sh->readers[reader].store(ACTIVE, std::memory_order_seq_cst);
+		joinCount++;
+		return true;
+	}
 
-	if (sh.freespace < sh.cBufferSize) // If buffer size is larger than freespace, meaning there are messages to be read in the buffer
+	for (int i = 0; i < COMLIB_MAX_READERS; i++)
 	{
+		unsigned int expected = FREE;
+
+		if (!sh->readers[i].compare_exchange_strong(expected, JOINING))
+			continue;
 
-		memcpy(&mh, mData + sh.cBuffer + sh.offset_tail, sizeof(mh));
+		// Start at the oldest message still in the buffer, like a late consumer does in the other modes
+		for (Lane& l : lanes)
+			l.lh->readers[i].tail.store(l.lh->tail.load(std::memory_order_seq_cst), std::memory_order_relaxed);
 
-		if (mh.id != 1) // At this point ID should always be one
+		sh->readers[i].store(ACTIVE, std::memory_order_seq_cst);
+
+		// The producer may have reused space before it saw this reader, move up to what it kept
+		for (Lane& l : lanes)
 		{
-			std::cout << "Read error" << std::endl;
-			return false;
+			const size_t kept = l.lh->tail.load(std::memory_order_seq_cst);
+
+			if (kept > l.lh->readers[i].tail.load(std::memory_order_relaxed))
+				l.lh->readers[i].tail.store(kept, std::memory_order_relaxed);
+		}
+
+		reader = i;
+		joinCount++;
+		return true;
+	}
+
+	if (!readerFull)
+		printf("No free reader slot, at most %d readers can be attached.\n", COMLIB_MAX_READERS);
+
+	readerFull = true;
+	return false;
+}
+
+std::atomic<size_t>& ComLib::tailOf(Lane& l)
+{
+	return (sh->mode == BROADCAST) ? l.lh->readers[reader].tail : l.lh->tail;
+}
+
+size_t ComLib::reclaim(Lane& l)
+{
+	if (sh->mode != BROADCAST)
+		return l.lh->tail.load(std::memory_order_acquire);
+
+	// The slowest active reader decides what can be reused. Published in tail so joining readers know where to start,
+	// and computed again if a reader joined meanwhile, it may not have seen the new tail yet.
+	const size_t head = l.lh->head.load(std::memory_order_relaxed);
+	unsigned int counted = 0;	// Readers the tail was computed from
+	unsigned int active = 0;	// Readers active after it was published
+	size_t tail = 0;
+
+	do
+	{
+		counted = 0;
+		tail = head;
+
+		for (int i = 0; i < COMLIB_MAX_READERS; i++)
+		{
+			if (sh->readers[i].load(std::memory_order_seq_cst) != ACTIVE)
+				continue;
+
+			const size_t readerTail = l.lh->readers[i].tail.load(std::memory_order_acquire);
+
+			if (readerTail < tail)
+				tail = readerTail;
+
+			counted |= 1u << i;
 		}
 
-		sh.freespace += mh.totalSize; // Add freespace for incoming message
+		if (counted == 0) // No readers, keep everything for the first one to attach
+			tail = l.lh->tail.load(std::memory_order_relaxed);
 
-		length = mh.msgLength;
+		l.lh->tail.store(tail, std::memory_order_seq_cst);
 
-		//msg = new char[mh.msgLength];
+		active = 0;
 
-		if ((sh.offset_tail + mh.totalSize) > sh.cBufferSize) // If msg lenght extends beyond buffer limit, then split the message
+		for (int i = 0; i < COMLIB_MAX_READERS; i++)
 		{
+			if (sh->readers[i].load(std::memory_order_seq_cst) == ACTIVE)
+				active |= 1u << i;
+		}
+	} while ((active & ~counted) != 0);
 
-			size_t msgSize_seg = sh.cBufferSize - (sh.offset_tail + sizeof(mh));
-			size_t remainder = mh.msgLength - msgSize_seg;
+	return tail;
+}
 
-			sh.offset_tail += sizeof(mh);
-			memcpy((char*)msg, mData + sh.cBuffer + sh.offset_tail, msgSize_seg); // Copy first message segment to memory
-			
-			sh.offset_tail = 0; // Put the head at the beginning of the circular buffer
-			memcpy(((char*)msg + msgSize_seg), mData + sh.cBuffer + sh.offset_tail, remainder); // Copy remainder of the message
+void ComLib::dropSlowest(Lane& l)
+{
+	int slowest = -1;
+	size_t tail = 0;
 
-			sh.offset_tail += remainder + mh.pad;
+	for (int i = 0; i < COMLIB_MAX_READERS; i++)
+	{
+		const size_t readerTail = l.lh->readers[i].tail.load(std::memory_order_relaxed);
 
+		if (sh->readers[i].load(std::memory_order_relaxed) == ACTIVE && (slowest == -1 || readerTail < tail))
+		{
+			slowest = i;
+			tail = readerTail;
 		}
-		else // Else write to memory as normal
+	}
+
+	if (slowest == -1)
+		return;
+
+	const auto now = std::chrono::steady_clock::now();
+
+	if (slowest != l.watchedReader || tail != l.watchedTail) // It is still moving
+	{
+		l.watchedReader = slowest;
+		l.watchedTail = tail;
+		l.watchedSince = now;
+		return;
+	}
+
+	if (now - l.watchedSince > std::chrono::milliseconds(COMLIB_DROP_TIMEOUT_MS))
+	{
+		unsigned int expected = ACTIVE;
+
+		if (sh->readers[slowest].compare_exchange_strong(expected, DROPPED))
 		{
+			printf("Dropped reader %d, it stopped reading.\n", slowest);
+			sh->readersDropped.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		l.watchedReader = -1;
+	}
+}
+
+ComLib::MsgHeader* ComLib::header(const Lane& l, const size_t position) const
+{
+	return reinterpret_cast<MsgHeader*>(l.buffer + position % l.lh->cBufferSize);
+}
+
+ComLib::MsgHeader* ComLib::front(Lane& l, size_t& tail, size_t& head)
+{
+	tail = tailOf(l).load(std::memory_order_relaxed);
+	head = l.lh->head.load(std::memory_order_acquire);
+
+	if (tail < l.lh->first) // Still where the generation before left off, this one starts after its REMAP marker
+		tail = l.lh->first;
+
+	// The rest of the lap was skipped by the producer, or a reservation was abandoned before the one after it
+	if (tail != head && header(l, tail)->id == WRAP)
+	{
+		while (tail != head && header(l, tail)->id == WRAP)
+			tail += header(l, tail)->totalSize;
+
+		tailOf(l).store(tail, std::memory_order_release);
+	}
+
+	if (tail == head || header(l, tail)->id == REMAP) // Nothing to be read in the buffer, or nothing more in this generation
+		return nullptr;
+
+	if (header(l, tail)->id != DATA && header(l, tail)->id != FRAGMENT) // At this point ID should always be DATA or FRAGMENT
+	{
+		std::cout << "Read error" << std::endl;
+		return nullptr;
+	}
+
+	return header(l, tail);
+}
+
+size_t ComLib::messageSize(const size_t length)
+{
+	return sizeof(MsgHeader) + length + (64 - (length + sizeof(MsgHeader)) % 64);
+}
+
+bool ComLib::claim(Lane& l, const size_t totalSize, size_t& head, size_t& tail, size_t& skip)
+{
+	const size_t bufferSize = l.lh->cBufferSize;
+
+	if (totalSize >= bufferSize / 2) // Messages are at most half of the buffer, larger ones are fragmented
+		return false;
+
+	while (true)
+	{
+		// Only producers move head, the consumer's tail is acquired so the space it frees is really free
+		head = (sh->mode == MPSC) ? l.lh->reserved.load(std::memory_order_relaxed) : l.lh->head.load(std::memory_order_relaxed);
+		tail = reclaim(l);
+
+		// A message is never split, if it does not fit before the end of the buffer the rest of the lap is skipped.
+		// A mirrored buffer needs no skip, a message running past the end continues in the mirror.
+		const size_t position = head % bufferSize;
+		skip = (!sh->mirrored && position + totalSize > bufferSize) ? bufferSize - position : 0;
+
+		// Room for a REMAP marker is always kept, so the lane can be closed whenever the segment is resized
+		if (totalSize + skip + messageSize(0) > bufferSize - (head - tail))
+			return false;
+
+		// MPSC: the space is ours once the reservation counter is moved past it, another producer may have got there first
+		if (sh->mode != MPSC || l.lh->reserved.compare_exchange_weak(head, head + skip + totalSize, std::memory_order_relaxed))
+			return true;
+	}
+}
+
+char* ComLib::allocate(Lane& l, const size_t length, const size_t id)
+{
+	if (mData == nullptr) { // Check if MapViewOfFile has unmapped and closed the handler
+		printf("Map view doesnt exist.\n");
+		exit(0);
+	}
+
+	const size_t totalSize = messageSize(length);
 
-			sh.offset_tail += sizeof(mh);
+	if (!enter(l, totalSize))
+		return nullptr;
 
-			memcpy((char*)msg, mData + sh.cBuffer + sh.offset_tail, mh.msgLength);
+	const size_t bufferSize = l.lh->cBufferSize;
 
-			sh.offset_tail += mh.msgLength + mh.pad;
+	size_t head = 0;
+	size_t tail = 0;
+	size_t skip = 0;
 
-			if (sh.cBufferSize <= sh.offset_tail)
-				sh.offset_tail = 0;
+	if (claim(l, totalSize, head, tail, skip))
+	{
+		// Several producers can be in here in MPSC, the high-water mark only ever goes up
+		const size_t occupancy = head + skip + totalSize - tail;
+		unsigned long long highWater = l.lh->counters.highWater.load(std::memory_order_relaxed);
+
+		while (occupancy > highWater && !l.lh->counters.highWater.compare_exchange_weak(highWater, occupancy, std::memory_order_relaxed));
+
+		if (head % bufferSize + totalSize > bufferSize)
+			l.lh->counters.wraps.fetch_add(1, std::memory_order_relaxed);
+
+		if (skip > 0)
+		{
+			MsgHeader* wrap = header(l, head);
+			wrap->id = WRAP;
+			wrap->totalSize = skip;
+			wrap->msgLength = 0;
+			wrap->pad = 0;
 		}
 
-		recv = true;
+		MsgHeader* mh = header(l, head + skip);
+		mh->id = id;
+		mh->msgLength = length;
+		mh->pad = totalSize - sizeof(MsgHeader) - length;
+		mh->totalSize = totalSize;
+		mh->start = head;
+		mh->end = head + skip + totalSize;
+
+		return reinterpret_cast<char*>(mh) + sizeof(MsgHeader);
+	}
+
+	if (sh->mode == LOCKED)
+		unlock();
+
+	if (sh->mode == BROADCAST && totalSize < (bufferSize / 2)) // Full, see if a reader is holding it up
+		dropSlowest(l);
+
+	return nullptr;
+}
+
+char* ComLib::reserve(const size_t length, const unsigned int laneIndex)
+{
+	return allocate(lane(laneIndex), length, DATA);
+}
+
+void ComLib::commit(char* data, const size_t length)
+{
+	Lane& l = owner(data);
+	MsgHeader* mh = reinterpret_cast<MsgHeader*>(data - sizeof(MsgHeader));
 
-		memcpy(mData, &sh, sizeof(sh)); // Lastly, update share header 
+	if (length < mh->msgLength && sh->mode == MPSC) // Space after it may be reserved already, it is kept as padding
+	{
+		mh->msgLength = length;
+		mh->pad = mh->totalSize - sizeof(MsgHeader) - length;
+	}
+	else if (length < mh->msgLength) // Less than reserved was written, give the unused space back
+	{
+		const size_t at = mh->end - mh->totalSize;
 
+		mh->msgLength = length;
+		mh->totalSize = messageSize(length);
+		mh->pad = mh->totalSize - sizeof(MsgHeader) - length;
+		mh->end = at + mh->totalSize;
 	}
 
-	ReleaseMutex(hMutex); // Unlock
+	// Skipped by another producer, this one took too long
+	if (!publish(l, mh))
+		return;
+
+	LaneCounters& counters = l.lh->counters;
+
+	if (mh->id == FRAGMENT) // The whole message is counted once sendFragmented is done
+	{
+		counters.fragments.fetch_add(1, std::memory_order_relaxed);
+	}
+	else
+	{
+		counters.sent.fetch_add(1, std::memory_order_relaxed);
+		counters.sentBytes.fetch_add(length, std::memory_order_relaxed);
+	}
 
-	return recv;
+	if (sh->mode == LOCKED)
+		unlock();
 }
 
-size_t ComLib::nextLength()
+void ComLib::abandon(char* data)
 {
-	memcpy(&mh, mData + sh.offset_tail, sizeof(mh));
+	Lane& l = owner(data);
+	MsgHeader* mh = reinterpret_cast<MsgHeader*>(data - sizeof(MsgHeader));
+
+	// From where it was reserved, a WRAP in front of it included, to its end as one WRAP
+	const size_t start = mh->start;
+	const size_t end = mh->end;
+	MsgHeader* skip = header(l, start);
 
-	return mh.msgLength;
+	skip->id = WRAP;
+	skip->totalSize = end - start;
+	skip->msgLength = 0;
+	skip->pad = 0;
+	skip->start = start;
+	skip->end = end;
+
+	publish(l, skip);
+
+	if (sh->mode == LOCKED)
+		unlock();
 }
 
-ComLib::~ComLib()
+// Moves head past a committed or abandoned reservation, the consumer sees it only after all of it has been written.
+// MPSC: reservations are published in the order they were made, this waits for the producers of the ones before.
+// If head does not move for COMLIB_LOCK_TIMEOUT_MS their producer is taken to be gone, everything from head up to
+// this reservation becomes one WRAP and is published with it. False if another producer skipped this one that way.
+bool ComLib::publish(Lane& l, MsgHeader* mh)
 {
-	//Sleep(1000);
+	if (sh->mode != MPSC)
+	{
+		l.lh->head.store(mh->end, std::memory_order_release);
+		return true;
+	}
 
-	CloseHandle(hMutex);
-	//std::cout << "Closing mutex handle..." << std::endl;
-	UnmapViewOfFile((LPCVOID)mData);
-	//std::cout << "Unmapping view..." << std::endl;
-	CloseHandle(hFileMap);
-	//std::cout << "Closing file handle..." << std::endl;
+	size_t head = l.lh->head.load(std::memory_order_acquire);
+	auto waitStart = std::chrono::steady_clock::now();
+
+	while (head != mh->start)
+	{
+		if (head > mh->start)
+			return false;
+
+		std::this_thread::yield();
+
+		const size_t moved = l.lh->head.load(std::memory_order_acquire);
+
+		if (moved != head) // Earlier producers are still committing
+		{
+			head = moved;
+			waitStart = std::chrono::steady_clock::now();
+			continue;
+		}
+
+		if (std::chrono::steady_clock::now() - waitStart < std::chrono::milliseconds(COMLIB_LOCK_TIMEOUT_MS))
+			continue;
+
+		// One producer at a time, two writing their WRAP at the same head would overwrite each other's
+		unsigned int expected = 0;
+
+		if (!l.lh->skipping.compare_exchange_strong(expected, 1, std::memory_order_acquire))
+			continue;
+
+		head = l.lh->head.load(std::memory_order_acquire);
+
+		if (head < mh->start)
+		{
+			MsgHeader* skip = header(l, head);
+
+			skip->id = WRAP;
+			skip->totalSize = mh->start - head;
+			skip->msgLength = 0;
+			skip->pad = 0;
+
+			printf("Skipped %zu bytes of reservations not committed for %d ms.\n", (size_t)(mh->start - head), COMLIB_LOCK_TIMEOUT_MS);
+
+			l.lh->head.store(mh->end, std::memory_order_release);
+		}
+
+		l.lh->skipping.store(0, std::memory_order_release);
+
+		if (head < mh->start)
+			return true;
+	}
+
+	l.lh->head.store(mh->end, std::memory_order_release);
+
+	return true;
+}
+
+bool ComLib::assemble(Lane& l, size_t& tail, const size_t head)
+{
+	while (tail != head && !l.reassemblyReady)
+	{
+		MsgHeader* mh = header(l, tail);
+
+		if (mh->id == WRAP)
+		{
+			tail += mh->totalSize;
+			continue;
+		}
+
+		if (mh->id != FRAGMENT) // The fragmented message was abandoned by the producer, leave the rest to the caller
+			break;
+
+		const FragmentHeader* fh = reinterpret_cast<const FragmentHeader*>(mh + 1);
+		const char* chunk = reinterpret_cast<const char*>(fh + 1);
+		const size_t chunkSize = mh->msgLength - sizeof(FragmentHeader);
+
+		if (fh->offset == 0) // First fragment, drops whatever is left of an abandoned message
+		{
+			l.reassemblySequence = fh->sequence;
+			l.reassembly.resize(fh->totalLength);
+			l.reassembled = 0;
+		}
+
+		if (fh->sequence == l.reassemblySequence && fh->offset == l.reassembled && l.reassembled + chunkSize <= l.reassembly.size())
+		{
+			memcpy(l.reassembly.data() + l.reassembled, chunk, chunkSize);
+			l.reassembled += chunkSize;
+			l.reassemblyReady = (l.reassembled == l.reassembly.size());
+		}
+		else // Missing or out of order fragment, wait for the start of the next message
+		{
+			l.reassemblySequence = 0;
+		}
+
+		tail += mh->totalSize;
+	}
+
+	return l.reassemblyReady;
+}
+
+bool ComLib::sendFragmented(Lane& l, const char* msg, const size_t length)
+{
+	// A quarter of the buffer per fragment, so the producer can fill one while the consumer reads another
+	const size_t chunkSize = l.lh->cBufferSize / 4 - sizeof(FragmentHeader) - 2 * sizeof(MsgHeader);
+	LaneCounters& counters = l.lh->counters;
+
+	// MPSC: the consumer reassembles one message at a time, producers take turns sending fragmented ones.
+	// Whole messages of other producers can still come between the fragments.
+	if (sh->mode == MPSC)
+	{
+		const auto waitStart = std::chrono::steady_clock::now();
+		unsigned int expected = 0;
+
+		while (!l.lh->fragmenting.compare_exchange_weak(expected, 1, std::memory_order_acquire))
+		{
+			if (std::chrono::steady_clock::now() - waitStart > std::chrono::milliseconds(COMLIB_LOCK_TIMEOUT_MS))
+				return false;
+
+			expected = 0;
+			std::this_thread::yield();
+		}
+	}
+
+	const size_t sequence = l.lh->fragmentSequence.fetch_add(1, std::memory_order_relaxed) + 1;
+
+	size_t offset = 0;
+	size_t lastTail = l.lh->tail.load(std::memory_order_relaxed);
+	auto lastProgress = std::chrono::steady_clock::now();
+	auto stallStart = lastProgress;
+	bool stalled = false;
+
+	while (offset < length)
+	{
+		const size_t size = (length - offset < chunkSize) ? length - offset : chunkSize;
+
+		char* data = allocate(l, sizeof(FragmentHeader) + size, FRAGMENT);
+
+		if (data == nullptr)
+		{
+			// Wait for the consumer to make room, give up once it stops making progress
+			const size_t tail = l.lh->tail.load(std::memory_order_relaxed);
+			const auto now = std::chrono::steady_clock::now();
+
+			if (!stalled)
+			{
+				stalled = true;
+				stallStart = now;
+			}
+
+			if (tail != lastTail)
+			{
+				lastTail = tail;
+				lastProgress = now;
+			}
+			else if (now - lastProgress > std::chrono::milliseconds(COMLIB_FRAGMENT_TIMEOUT_MS))
+			{
+				counters.sendStallNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(now - stallStart).count(), std::memory_order_relaxed);
+
+				if (sh->mode == MPSC)
+					l.lh->fragmenting.store(0, std::memory_order_release);
+
+				return false;
+			}
+
+			std::this_thread::yield();
+			continue;
+		}
+
+		if (stalled)
+		{
+			stalled = false;
+			counters.sendStallNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - stallStart).count(), std::memory_order_relaxed);
+		}
+
+		FragmentHeader fh;
+		fh.sequence = sequence;
+		fh.offset = offset;
+		fh.totalLength = length;
+
+		memcpy(data, &fh, sizeof(FragmentHeader));
+		memcpy(data + sizeof(FragmentHeader), msg + offset, size);
+
+		commit(data, sizeof(FragmentHeader) + size);
+
+		offset += size;
+	}
+
+	if (sh->mode == MPSC)
+		l.lh->fragmenting.store(0, std::memory_order_release);
+
+	counters.sent.fetch_add(1, std::memory_order_relaxed);
+	counters.sentBytes.fetch_add(length, std::memory_order_relaxed);
+
+	return true;
+}
+
+const char* ComLib::peekLane(Lane& l, size_t& length)
+{
+	size_t head = 0;
+	MsgHeader* mh = l.reassemblyReady ? nullptr : front(l, l.peekedTail, head);
+
+	// Fragments are copied out of the buffer as they arrive, the message is handed out once it is complete
+	while (mh != nullptr && mh->id == FRAGMENT)
+	{
+		assemble(l, l.peekedTail, head);
+		tailOf(l).store(l.peekedTail, std::memory_order_release);
+
+		mh = l.reassemblyReady ? nullptr : front(l, l.peekedTail, head);
+	}
+
+	if (l.reassemblyReady)
+	{
+		length = l.reassembly.size();
+		return l.reassembly.data();
+	}
+
+	if (mh == nullptr)
+		return nullptr;
+
+	length = mh->msgLength;
+
+	return reinterpret_cast<const char*>(mh) + sizeof(MsgHeader);
+}
+
+const char* ComLib::peek(size_t& length, unsigned int* lane)
+{
+	if (mData == nullptr) { // Check if other process has unmapped and closed the handler
+		printf("Map view doesnt exist.\n");
+		exit(0);
+	}
+
+	if (!follow())
+		return nullptr;
+
+	if (sh->mode == LOCKED && !lock())
+		return nullptr;
+
+	// Lane 0 first, a lower priority lane is only looked at while all above it are empty
+	for (unsigned int i = 0; i < lanes.size(); i++)
+	{
+		const char* data = peekLane(lanes[i], length);
+
+		if (data != nullptr)
+		{
+			peekedLane = i;
+
+			if (lane != nullptr)
+				*lane = i;
+
+			return data;
+		}
+	}
+
+	if (sh->mode == LOCKED)
+		unlock();
+
+	return nullptr;
+}
+
+void ComLib::release()
+{
+	Lane& l = lanes[peekedLane];
+
+	l.lh->counters.received.fetch_add(1, std::memory_order_relaxed);
+
+	if (l.reassemblyReady) // The fragments already left the buffer
+	{
+		l.lh->counters.receivedBytes.fetch_add(l.reassembly.size(), std::memory_order_relaxed);
+		l.reassemblyReady = false;
+	}
+	else // Hand the space back to the producer only after the caller is done with the view
+	{
+		l.lh->counters.receivedBytes.fetch_add(header(l, l.peekedTail)->msgLength, std::memory_order_relaxed);
+		tailOf(l).store(l.peekedTail + header(l, l.peekedTail)->totalSize, std::memory_order_release);
+	}
+
+	if (sh->mode == LOCKED)
+		unlock();
+}
+
+bool ComLib::send(const void* msg, const size_t length, const unsigned int laneIndex)
+{
+	Lane& l = lane(laneIndex);
+
+	bool sent = false;
+
+	if (messageSize(length) >= l.lh->cBufferSize / 2 && resizeMax > l.lh->cBufferSize)
+	{
+		// The lanes may grow enough for the message to go in one piece
+		if (enter(l, messageSize(length)) && sh->mode == LOCKED)
+			unlock();
+	}
+
+	if (messageSize(length) >= l.lh->cBufferSize / 2) // Too large for the buffer in one piece
+	{
+		sent = sendFragmented(l, static_cast<const char*>(msg), length);
+	}
+	else
+	{
+		char* data = allocate(l, length, DATA);
+
+		if (data != nullptr)
+		{
+			memcpy(data, msg, length);
+			commit(data, length);
+			sent = true;
+		}
+	}
+
+	if (!sent) // Counted, as the caller may well ignore it
+		l.lh->counters.failedSends.fetch_add(1, std::memory_order_relaxed);
+
+	return sent;
+}
+
+bool ComLib::recv(char* msg, size_t& length)
+{
+	const char* data = peek(length);
+
+	if (data == nullptr)
+		return false;
+
+	memcpy(msg, data, length);
+	release();
+
+	return true;
+}
+
+size_t ComLib::drainLane(Lane& l, char* msgs, const size_t capacity, size_t& used, size_t* lengths, const size_t maxCount)
+{
+	const size_t usedBefore = used;
+	size_t count = 0;
+	size_t tail = 0;
+	size_t head = 0;
+
+	// Head is acquired once and tail published once, everything drained is handed back to the producer at the end
+	MsgHeader* mh = front(l, tail, head);
+
+	while (count < maxCount && (mh != nullptr || l.reassemblyReady))
+	{
+		if (!l.reassemblyReady && mh->id == FRAGMENT)
+			assemble(l, tail, head);
+
+		if (l.reassemblyReady) // A fragmented message is complete
+		{
+			if (used + l.reassembly.size() > capacity) // Leave it for the next call, nextLength tells how large it is
+				break;
+
+			memcpy(msgs + used, l.reassembly.data(), l.reassembly.size());
+
+			lengths[count++] = l.reassembly.size();
+			used += l.reassembly.size();
+			l.reassemblyReady = false;
+		}
+		else if (mh->id == DATA)
+		{
+			if (used + mh->msgLength > capacity) // Leave it for the next call
+				break;
+
+			memcpy(msgs + used, reinterpret_cast<char*>(mh) + sizeof(MsgHeader), mh->msgLength);
+
+			lengths[count++] = mh->msgLength;
+			used += mh->msgLength;
+			tail += mh->totalSize;
+		}
+		else if (tail == head) // Only part of a fragmented message has arrived so far
+		{
+			break;
+		}
+
+		while (tail != head && header(l, tail)->id == WRAP)
+			tail += header(l, tail)->totalSize;
+
+		mh = (tail != head && header(l, tail)->id != REMAP) ? header(l, tail) : nullptr;
+	}
+
+	tailOf(l).store(tail, std::memory_order_release);
+
+	if (count > 0)
+	{
+		l.lh->counters.received.fetch_add(count, std::memory_order_relaxed);
+		l.lh->counters.receivedBytes.fetch_add(used - usedBefore, std::memory_order_relaxed);
+	}
+
+	return count;
+}
+
+size_t ComLib::recvBatch(char* msgs, const size_t capacity, size_t* lengths, const size_t maxCount)
+{
+	if (mData == nullptr) { // Check if other process has unmapped and closed the handler
+		printf("Map view doesnt exist.\n");
+		exit(0);
+	}
+
+	if (!follow())
+		return 0;
+
+	if (sh->mode == LOCKED && !lock())
+		return 0;
+
+	size_t count = 0;
+	size_t used = 0;
+
+	// Lanes are drained in priority order, a lane is only started once the one above it is empty
+	for (Lane& l : lanes)
+	{
+		count += drainLane(l, msgs, capacity, used, lengths + count, maxCount - count);
+
+		size_t tail = 0;
+		size_t head = 0;
+
+		if (count == maxCount || l.reassemblyReady || front(l, tail, head) != nullptr)
+			break;
+	}
+
+	if (sh->mode == LOCKED)
+		unlock();
+
+	return count;
+}
+
+size_t ComLib::written(const unsigned int laneIndex)
+{
+	return lane(laneIndex).lh->head.load(std::memory_order_relaxed);
+}
+
+size_t ComLib::consumed(const unsigned int laneIndex)
+{
+	return reclaim(lane(laneIndex));
+}
+
+size_t ComLib::nextLength()
+{
+	if (!follow())
+		return 0;
+
+	if (sh->mode == LOCKED && !lock())
+		return 0;
+
+	size_t length = 0;
+
+	for (Lane& l : lanes)
+	{
+		size_t tail = 0;
+		size_t head = 0;
+		MsgHeader* mh = l.reassemblyReady ? nullptr : front(l, tail, head);
+
+		if (l.reassemblyReady)
+			length = l.reassembly.size();
+		else if (mh != nullptr && mh->id == FRAGMENT) // Size of the whole message, not the fragment
+			length = reinterpret_cast<const FragmentHeader*>(mh + 1)->totalLength;
+		else if (mh != nullptr)
+			length = mh->msgLength;
+
+		if (length > 0)
+			break;
+	}
+
+	if (sh->mode == LOCKED)
+		unlock();
+
+	return length;
+}
+
+unsigned int ComLib::joins() const
+{
+	return joinCount;
+}
+
+ComLib::Stats ComLib::stats() const
+{
+	Stats stats;
+	stats.mode = sh->mode;
+	stats.laneCount = sh->laneCount;
+	stats.generation = sh->generation;
+
+	for (unsigned int i = 0; i < sh->laneCount; i++)
+	{
+		const LaneHeader& lh = sh->lanes[i];
+		LaneStats& ls = stats.lanes[i];
+
+		ls.sent = lh.counters.sent.load(std::memory_order_relaxed);
+		ls.sentBytes = lh.counters.sentBytes.load(std::memory_order_relaxed);
+		ls.failedSends = lh.counters.failedSends.load(std::memory_order_relaxed);
+		ls.fragments = lh.counters.fragments.load(std::memory_order_relaxed);
+		ls.wraps = lh.counters.wraps.load(std::memory_order_relaxed);
+		ls.sendStallNs = lh.counters.sendStallNs.load(std::memory_order_relaxed);
+		ls.received = lh.counters.received.load(std::memory_order_relaxed);
+		ls.receivedBytes = lh.counters.receivedBytes.load(std::memory_order_relaxed);
+		ls.highWater = lh.counters.highWater.load(std::memory_order_relaxed);
+		ls.capacity = lh.cBufferSize;
+
+		// BROADCAST: the tail is the slowest reader as of the producer's last send
+		const size_t tail = lh.tail.load(std::memory_order_relaxed);
+		const size_t head = lh.head.load(std::memory_order_relaxed);
+		ls.occupancy = (head > tail) ? head - tail : 0;
+	}
+
+	stats.lockWaits = sh->lockWaits.load(std::memory_order_relaxed);
+	stats.lockWaitNs = sh->lockWaitNs.load(std::memory_order_relaxed);
+	stats.lockTimeouts = sh->lockTimeouts.load(std::memory_order_relaxed);
+	stats.readersDropped = sh->readersDropped.load(std::memory_order_relaxed);
+
+	for (int i = 0; i < COMLIB_MAX_READERS; i++)
+	{
+		if (sh->readers[i].load(std::memory_order_relaxed) == ACTIVE)
+			stats.readers++;
+	}
+
+	return stats;
+}
+
+std::unique_ptr<ComLib> ComLib::attachGeneration(const unsigned int generation, const size_t buffSize)
+{
+	// Creates the segment if it is gone, as generation 0 would be
+	std::unique_ptr<ComLib> next(new ComLib(name + "@" + std::to_string(generation), buffSize, sh->mode, sh->mirrored, sh->laneCount, generation));
+	next->name = name;
+
+	return next;
+}
+
+std::unique_ptr<ComLib> ComLib::nextGeneration()
+{
+	std::unique_ptr<ComLib> next = attachGeneration(sh->successor.load(std::memory_order_acquire), lanes[0].lh->cBufferSize);
+
+	// Gone, its producer let it go before this process came for it. Whatever was sent in it is lost.
+	if (next->created)
+	{
+		const unsigned int latest = ((origin != nullptr) ? origin->sh : sh)->latest.load(std::memory_order_acquire);
+
+		next.reset();
+		next = attachGeneration(latest, lanes[0].lh->cBufferSize);
+	}
+
+	return next;
+}
+
+std::unique_ptr<ComLib> ComLib::retire(const size_t buffSize)
+{
+	std::unique_ptr<ComLib> next = attachGeneration(sh->generation + 1, buffSize);
+	SharedHeader* nextHeader = next->sh;
+
+	// Lanes carry on where they leave off here, after the REMAP marker, so written() and consumed() keep counting up.
+	// What readers still have to read here is counted as in use there, until they have moved on.
+	for (unsigned int i = 0; i < sh->laneCount; i++)
+	{
+		LaneHeader& from = sh->lanes[i];
+		LaneHeader& to = nextHeader->lanes[i];
+		const size_t first = from.head.load(std::memory_order_relaxed) + messageSize(0);
+
+		to.first = first;
+		to.head.store(first, std::memory_order_relaxed);
+		to.reserved.store(first, std::memory_order_relaxed);
+		to.tail.store(reclaim(lanes[i]), std::memory_order_relaxed);
+		to.fragmentSequence.store(from.fragmentSequence.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+		for (unsigned int r = 0; r < COMLIB_MAX_READERS; r++)
+			to.readers[r].tail.store((sh->readers[r].load(std::memory_order_seq_cst) == ACTIVE) ? from.readers[r].tail.load(std::memory_order_acquire) : first, std::memory_order_relaxed);
+
+		// Counters go on from where they are, as seen by a monitor
+		std::atomic<unsigned long long>* counters[][2] = {
+			{ &from.counters.sent, &to.counters.sent }, { &from.counters.sentBytes, &to.counters.sentBytes },
+			{ &from.counters.failedSends, &to.counters.failedSends }, { &from.counters.fragments, &to.counters.fragments },
+			{ &from.counters.wraps, &to.counters.wraps }, { &from.counters.sendStallNs, &to.counters.sendStallNs },
+			{ &from.counters.highWater, &to.counters.highWater }, { &from.counters.received, &to.counters.received },
+			{ &from.counters.receivedBytes, &to.counters.receivedBytes }
+		};
+
+		for (auto& counter : counters)
+			counter[1]->store(counter[0]->load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+
+	// BROADCAST: readers keep their slots, the producer must not reuse space they have yet to see
+	for (int r = 0; r < COMLIB_MAX_READERS; r++)
+	{
+		if (sh->readers[r].load(std::memory_order_seq_cst) == ACTIVE)
+			nextHeader->readers[r].store(ACTIVE, std::memory_order_seq_cst);
+	}
+
+	nextHeader->lockWaits.store(sh->lockWaits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	nextHeader->lockWaitNs.store(sh->lockWaitNs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	nextHeader->lockTimeouts.store(sh->lockTimeouts.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	nextHeader->readersDropped.store(sh->readersDropped.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+	// Every lane ends in a REMAP marker, claim always leaves room for one
+	for (Lane& l : lanes)
+	{
+		const size_t head = l.lh->head.load(std::memory_order_relaxed);
+
+		MsgHeader* mh = header(l, head);
+		mh->id = REMAP;
+		mh->msgLength = 0;
+		mh->totalSize = messageSize(0);
+		mh->pad = mh->totalSize - sizeof(MsgHeader);
+		mh->start = head;
+		mh->end = head + mh->totalSize;
+
+		l.lh->head.store(mh->end, std::memory_order_release);
+	}
+
+	// Published once the markers are in, a consumer that sees the successor reads up to them and moves on
+	sh->successor.store(nextHeader->generation, std::memory_order_release);
+	((origin != nullptr) ? origin->sh : sh)->latest.store(nextHeader->generation, std::memory_order_release);
+
+	peakUse = 0;
+	peakSince = std::chrono::steady_clock::now();
+
+	return next;
+}
+
+std::unique_ptr<ComLib> ComLib::adopt(std::unique_ptr<ComLib> next)
+{
+	// BROADCAST: a reader keeps its slot if the producer carried it over, it joins the new generation otherwise
+	if (reader >= 0)
+	{
+		sh->readers[reader].store(FREE, std::memory_order_release);
+
+		if (next->sh->readers[reader].load(std::memory_order_seq_cst) != ACTIVE)
+			reader = -1;
+	}
+
+	// The mapping changes hands, the state of this process (reassembly, reader slot, limits) stays
+	std::swap(hFileMap, next->hFileMap);
+#if defined(_WIN32)
+	std::swap(mViews, next->mViews);
+#else
+	std::swap(shmName, next->shmName);
+	std::swap(mapSize, next->mapSize);
+	std::swap(viewSize, next->viewSize);
+#endif
+	std::swap(mData, next->mData);
+	std::swap(sh, next->sh);
+	std::swap(hMutex, next->hMutex);
+
+	for (size_t i = 0; i < lanes.size(); i++)
+	{
+		std::swap(lanes[i].lh, next->lanes[i].lh);
+		std::swap(lanes[i].buffer, next->lanes[i].buffer);
+		lanes[i].watchedReader = -1;
+	}
+
+	// next now holds the old generation, the last process to leave it removes it.
+	// Generation 0 is kept, it is where a late joiner finds the one in use.
+	if (next->sh->generation == 0)
+		origin = std::move(next);
+
+	return next;
+}
+
+void ComLib::prune()
+{
+	// A retired generation is let go once every reader has read it up to its markers, or it has no readers left.
+	// A reader that still comes for it later finds it gone and goes to the generation in use, see nextGeneration.
+	for (size_t i = 0; i < retired.size(); )
+	{
+		ComLib& old = *retired[i];
+		bool done = true;
+
+		for (Lane& l : old.lanes)
+			done = done && old.reclaim(l) + messageSize(0) >= l.lh->head.load(std::memory_order_relaxed);
+
+		if (old.sh->mode == BROADCAST)
+		{
+			bool readers = false;
+
+			for (int r = 0; r < COMLIB_MAX_READERS; r++)
+				readers = readers || old.sh->readers[r].load(std::memory_order_seq_cst) == ACTIVE;
+
+			done = done || !readers;
+		}
+
+		if (done)
+			retired.erase(retired.begin() + i);
+		else
+			i++;
+	}
+}
+
+size_t ComLib::wanted(Lane& l, const size_t totalSize)
+{
+	const size_t bufferSize = l.lh->cBufferSize;
+	const size_t used = l.lh->head.load(std::memory_order_relaxed) - reclaim(l) + totalSize;
+	size_t target = bufferSize;
+
+	// Grow while the lane would be more than COMLIB_GROW_PERCENT full, or the message would have to be fragmented
+	while (target < resizeMax && (used > target / 100 * COMLIB_GROW_PERCENT || totalSize >= target / 2))
+		target = (target * 2 < resizeMax) ? target * 2 : resizeMax;
+
+	if (used > peakUse)
+		peakUse = used;
+
+	const auto now = std::chrono::steady_clock::now();
+
+	// Shrink once no lane needed more than COMLIB_SHRINK_PERCENT for a whole period
+	if (target == bufferSize && now - peakSince > std::chrono::milliseconds(COMLIB_SHRINK_MS))
+	{
+		if (peakUse < bufferSize / 100 * COMLIB_SHRINK_PERCENT && bufferSize / 2 >= resizeMin)
+			target = bufferSize / 2;
+
+		peakUse = 0;
+		peakSince = now;
+	}
+
+	return target;
+}
+
+bool ComLib::enter(Lane& l, const size_t totalSize)
+{
+	// Takes the lock (LOCKED) in the generation in use. Moves on first if another producer replaced this one,
+	// or replaces it when the lane crossed a threshold.
+	while (true)
+	{
+		if (!retired.empty())
+			prune();
+
+		if (sh->mode == LOCKED && !lock())
+			return false;
+
+		const unsigned int successor = sh->successor.load(std::memory_order_acquire);
+		const size_t target = (successor == 0 && resizeMax > 0) ? wanted(l, totalSize) : l.lh->cBufferSize;
+
+		if (successor == 0 && target == l.lh->cBufferSize)
+			return true;
+
+		std::unique_ptr<ComLib> next = (successor == 0) ? retire(target) : nextGeneration();
+
+		if (sh->mode == LOCKED)
+			unlock();
+
+		std::unique_ptr<ComLib> old = adopt(std::move(next));
+
+		if (successor == 0 && old != nullptr) // Readers may still be on their way through it
+			retired.push_back(std::move(old));
+	}
+}
+
+bool ComLib::drained()
+{
+	if (sh->successor.load(std::memory_order_acquire) == 0)
+		return false;
+
+	// The markers are in once the successor is published, everything before them must have been read
+	for (Lane& l : lanes)
+	{
+		const size_t tail = std::max(tailOf(l).load(std::memory_order_acquire), l.lh->first);
+		const size_t head = l.lh->head.load(std::memory_order_acquire);
+
+		if (tail != head && header(l, tail)->id != REMAP)
+			return false;
+	}
+
+	return true;
+}
+
+bool ComLib::follow()
+{
+	if (sh->mode == BROADCAST && !attach())
+		return false;
+
+	while (drained())
+	{
+		adopt(nextGeneration());
+
+		if (sh->mode == BROADCAST && !attach())
+			return false;
+	}
+
+	return true;
+}
+
+bool ComLib::resize(const size_t buffSize)
+{
+	if (sh->mode == MPSC || !enter(lanes[0], 0))
+		return false;
+
+	// What is in use moves along as part of the new lanes, see retire
+	bool fits = true;
+
+	for (Lane& l : lanes)
+		fits = fits && l.lh->head.load(std::memory_order_relaxed) - reclaim(l) + messageSize(0) < buffSize / 2;
+
+	std::unique_ptr<ComLib> next = fits ? retire(buffSize) : nullptr;
+
+	if (sh->mode == LOCKED)
+		unlock();
+
+	if (next != nullptr)
+	{
+		std::unique_ptr<ComLib> old = adopt(std::move(next));
+
+		if (old != nullptr)
+			retired.push_back(std::move(old));
+	}
+
+	return fits;
+}
+
+void ComLib::autoResize(const size_t minSize, const size_t maxSize)
+{
+	if (sh->mode == MPSC)
+	{
+		printf("Resizing is not supported in MPSC mode.\n");
+		return;
+	}
+
+	resizeMin = minSize;
+	resizeMax = maxSize;
+	peakUse = 0;
+	peakSince = std::chrono::steady_clock::now();
+}
+
+void ComLib::refresh()
+{
+	while (sh->successor.load(std::memory_order_acquire) != 0)
+		adopt(nextGeneration());
+}
+
+#if defined(_WIN32)
+bool ComLib::exists(const std::string& secret)
+{
+	HANDLE handle = OpenFileMappingA(FILE_MAP_READ, FALSE, secret.c_str());
+
+	if (handle == NULL)
+		return false;
+
+	CloseHandle(handle);
+	return true;
+}
+
+bool ComLib::lock()
+{
+	// Uncontended, no need to time it
+	DWORD result = WaitForSingleObject(hMutex, 0);
+
+	if (result == WAIT_OBJECT_0 || result == WAIT_ABANDONED)
+		return true;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	// WAIT_ABANDONED: the previous owner died while holding the mutex, ownership is still granted
+	result = WaitForSingleObject(hMutex, COMLIB_LOCK_TIMEOUT_MS);
+
+	sh->lockWaits.fetch_add(1, std::memory_order_relaxed);
+	sh->lockWaitNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+
+	if (result == WAIT_OBJECT_0 || result == WAIT_ABANDONED)
+		return true;
+
+	sh->lockTimeouts.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+void ComLib::unlock()
+{
+	ReleaseMutex(hMutex);
+}
+
+ComLib::~ComLib()
+{
+	//Sleep(1000);
+
+	if (reader >= 0) // Stop holding up the producer
+		sh->readers[reader].store(FREE, std::memory_order_release);
+
+	CloseHandle(hMutex);
+	//std::cout << "Closing mutex handle..." << std::endl;
+	if (mViews.empty())
+	{
+		UnmapViewOfFile((LPCVOID)mData);
+	}
+	else // Mirrored, mData is the first of the views
+	{
+		for (char* view : mViews)
+			UnmapViewOfFile((LPCVOID)view);
+	}
+	//std::cout << "Unmapping view..." << std::endl;
+	CloseHandle(hFileMap);
+	//std::cout << "Closing file handle..." << std::endl;
+}
+#else
+bool ComLib::exists(const std::string& secret)
+{
+	int handle = shm_open(("/" + secret).c_str(), O_RDONLY, 0666);
+
+	if (handle == -1)
+		return false;
+
+	close(handle);
+	return true;
+}
+
+void ComLib::unlinkStale(const std::string& name, const int handle)
+{
+	const int named = shm_open(name.c_str(), O_RDONLY, 0666);
+
+	if (named == -1)
+		return;
+
+	struct stat mine {}, current {};
+
+	if (fstat(handle, &mine) == 0 && fstat(named, &current) == 0 && mine.st_dev == current.st_dev && mine.st_ino == current.st_ino)
+		shm_unlink(name.c_str());
+
+	close(named);
+}
+
+bool ComLib::lock()
+{
+	int result = pthread_mutex_trylock(hMutex);
+
+	// Uncontended, no need to time it
+	if (result == 0 || result == EOWNERDEAD)
+	{
+		if (result == EOWNERDEAD)
+			pthread_mutex_consistent(hMutex);
+
+		return true;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+
+	timespec timeout{};
+	clock_gettime(CLOCK_REALTIME, &timeout);
+	timeout.tv_sec += COMLIB_LOCK_TIMEOUT_MS / 1000;
+	timeout.tv_nsec += (COMLIB_LOCK_TIMEOUT_MS % 1000) * 1000000L;
+	if (timeout.tv_nsec >= 1000000000L)
+	{
+		timeout.tv_sec++;
+		timeout.tv_nsec -= 1000000000L;
+	}
+
+	result = pthread_mutex_timedlock(hMutex, &timeout);
+
+	// EOWNERDEAD: the previous owner died while holding the lock, take it over
+	if (result == EOWNERDEAD)
+	{
+		pthread_mutex_consistent(hMutex);
+		result = 0;
+	}
+
+	sh->lockWaits.fetch_add(1, std::memory_order_relaxed);
+	sh->lockWaitNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+
+	if (result != 0)
+		sh->lockTimeouts.fetch_add(1, std::memory_order_relaxed);
+
+	return (result == 0);
+}
+
+void ComLib::unlock()
+{
+	pthread_mutex_unlock(hMutex);
+}
+
+ComLib::~ComLib()
+{
+	SharedMutex* sm = reinterpret_cast<SharedMutex*>(hMutex);
+
+	if (reader >= 0) // Stop holding up the producer
+		sh->readers[reader].store(FREE, std::memory_order_release);
+
+	if (pthread_mutex_lock(hMutex) == EOWNERDEAD)
+		pthread_mutex_consistent(hMutex);
+	bool last = (--sm->users == 0);
+	pthread_mutex_unlock(hMutex);
+
+	munmap(mData, viewSize);
+	close(hFileMap);
+
+	// Unlike a Win32 mapping, a POSIX object outlives its handles until unlinked
+	if (last)
+		shm_unlink(shmName.c_str());
 }
+#endif
@@ -75,47 +75,342 @@ typedef struct tagBITMAPINFOHEADER {
 #if defined(_MSC_VER) || defined(__TINYC__)
 #include "propidl.h"
 #endif
+#else
+// POSIX backend: shm_open/mmap segment guarded by a robust process-shared mutex
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
 #endif
 
 //#include <tchar.h>
 //#include <stdio.h>
 #include <iostream>
+#include <string>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <chrono>
 //#include <dos.h>
 #include <memory.h>
 
+// How long send/recv wait for the segment lock before giving up (LOCKED mode only)
+#define COMLIB_LOCK_TIMEOUT_MS 1000
+// How long a fragmented send waits for the consumer to free space before giving up
+#define COMLIB_FRAGMENT_TIMEOUT_MS 250
+// Most priority lanes a segment can be split into
+#define COMLIB_MAX_LANES 4
+// Most readers attached at once in BROADCAST mode
+#define COMLIB_MAX_READERS 8
+// How long the slowest reader may hold up a full buffer before it is dropped (BROADCAST mode only)
+#define COMLIB_DROP_TIMEOUT_MS 2000
+// Automatic resizing, see autoResize(): a lane filling past COMLIB_GROW_PERCENT doubles the segment,
+// one that stayed under COMLIB_SHRINK_PERCENT for COMLIB_SHRINK_MS halves it
+#define COMLIB_GROW_PERCENT 75
+#define COMLIB_SHRINK_PERCENT 10
+#define COMLIB_SHRINK_MS 10000
+
 class ComLib
 {
+public:
+	// LOCKED: every send/recv takes the segment mutex, any number of producers/consumers
+	// SPSC:   exactly one producer and one consumer, head/tail are published lock-free
+	// BROADCAST: one producer, up to COMLIB_MAX_READERS consumers that each receive every message.
+	//         Space is reused once the slowest reader is past it, a reader holding up a full buffer is dropped.
+	// MPSC:   any number of producers (threads of one ComLib or other processes) and one consumer. Producers claim
+	//         space with a CAS and write their messages at the same time, messages are published in the order
+	//         they were reserved. A producer must commit what it reserves, later messages wait for it.
+	// The mode is chosen by the process that creates the segment, later processes follow it
+	enum MODE { LOCKED, SPSC, BROADCAST, MPSC };
+
+	// Snapshot of the counters kept in the segment, see stats()
+	struct LaneStats
+	{
+		unsigned long long sent = 0;			// Messages sent, a fragmented message counts once
+		unsigned long long sentBytes = 0;
+		unsigned long long failedSends = 0;		// send() calls that returned false
+		unsigned long long fragments = 0;
+		unsigned long long wraps = 0;			// Messages that reached the end of the buffer (skipped or ran into the mirror)
+		unsigned long long sendStallNs = 0;		// Time a fragmented send waited for room
+		unsigned long long received = 0;		// Messages received, by all readers together
+		unsigned long long receivedBytes = 0;
+		unsigned long long occupancy = 0;		// Bytes in use right now
+		unsigned long long highWater = 0;		// Most bytes ever in use
+		unsigned long long capacity = 0;
+	};
+
+	struct Stats
+	{
+		MODE mode = LOCKED;
+		unsigned int laneCount = 0;
+		unsigned int generation = 0;			// Times the segment was resized
+		LaneStats lanes[COMLIB_MAX_LANES];
+		unsigned long long lockWaits = 0;		// Times the segment lock was already taken (LOCKED mode)
+		unsigned long long lockWaitNs = 0;		// Time spent waiting for it
+		unsigned long long lockTimeouts = 0;
+		unsigned int readers = 0;				// Attached readers (BROADCAST mode)
+		unsigned long long readersDropped = 0;
+	};
+
 private:
+#if defined(_WIN32)
 	HANDLE hFileMap;
+	std::vector<char*> mViews;	// Header and two views of every lane when mirrored
+#else
+	int hFileMap;			// shm_open file descriptor
+	std::string shmName;	// "/" + secret
+	size_t mapSize;			// Size of the shared memory object
+	size_t viewSize;		// Size of the mapped address range, twice the buffer when mirrored
+#endif
 	char* mData;
 
+	// Head and tail are monotonic byte counters, their position in the buffer is counter % cBufferSize.
+	// Each sits on its own cache line so the producer and the consumer never write to the same line.
+	struct ReaderTail
+	{
+		alignas(64) std::atomic<size_t> tail;	// Bytes read by one BROADCAST reader
+	};
+
+	// Producer and consumer counters on separate cache lines, updated with relaxed atomics
+	struct LaneCounters
+	{
+		alignas(64) std::atomic<unsigned long long> sent;
+		std::atomic<unsigned long long> sentBytes;
+		std::atomic<unsigned long long> failedSends;
+		std::atomic<unsigned long long> fragments;
+		std::atomic<unsigned long long> wraps;
+		std::atomic<unsigned long long> sendStallNs;
+		std::atomic<unsigned long long> highWater;
+		alignas(64) std::atomic<unsigned long long> received;
+		std::atomic<unsigned long long> receivedBytes;
+	};
+
+	struct LaneHeader
+	{
+		alignas(64) std::atomic<size_t> head;	// Bytes written, only advanced by producers
+		alignas(64) std::atomic<size_t> reserved;	// MPSC: bytes claimed by producers, head follows as they commit
+		std::atomic<size_t> fragmentSequence;	// Last fragmented message number used on the lane
+		std::atomic<unsigned int> fragmenting;	// MPSC: a producer is sending a fragmented message
+		std::atomic<unsigned int> skipping;		// MPSC: a producer is skipping reservations that were not committed
+		alignas(64) std::atomic<size_t> tail;	// Bytes read, only advanced by the consumer. BROADCAST: bytes every reader is past
+		alignas(64) size_t cBuffer;				// Location to start of circular buffer
+		size_t cBufferSize;						// Buffer size
+		size_t first;							// Head the lane started at, where the generation before it left off
+		ReaderTail readers[COMLIB_MAX_READERS];	// BROADCAST only
+		LaneCounters counters;
+	};
+
+	enum READERSTATE { FREE = 0, JOINING = 1, ACTIVE = 2, DROPPED = 3 };
+
 	struct SharedHeader
 	{
-		size_t offset_head = 0;	// Location of head, where producer is writing
-		size_t offset_tail = 0;	// Location of tail, where consumer is reading
-		size_t freespace = 0;	// Current freespace in buffer
-		size_t cBuffer = 0;		// Location to start of circular buffer
-		size_t cBufferSize = 0;	// Buffer size
-	} sh;
+		MODE mode;								// Chosen by the process that created the segment
+		bool mirrored;							// Buffers are mapped twice back-to-back, messages never wrap
+		unsigned int laneCount;
+		unsigned int generation;				// 0 for the segment named secret, n for secret@n, see resize()
+		std::atomic<unsigned int> successor;	// Generation that replaced this one, 0 while it is in use
+		std::atomic<unsigned int> latest;		// Generation 0 only: the one in use, where late joiners go
+		LaneHeader lanes[COMLIB_MAX_LANES];		// Lane 0 has the highest priority
+		alignas(64) std::atomic<unsigned int> readers[COMLIB_MAX_READERS];	// BROADCAST: READERSTATE of each reader slot
+		alignas(64) std::atomic<unsigned long long> lockWaits;
+		std::atomic<unsigned long long> lockWaitNs;
+		std::atomic<unsigned long long> lockTimeouts;
+		std::atomic<unsigned long long> readersDropped;
+	};
 
+	SharedHeader* sh;
+
+	// Precedes every message in the buffer, messages start 64 byte aligned and are never split
 	struct MsgHeader
 	{
-		size_t id = 0;
-		size_t totalSize = 0;
+		size_t id = 0;			// DATA, or WRAP when the rest of the lap is unused, or REMAP at the end of a generation
+		size_t totalSize = 0;	// Header + message + pad
 		size_t msgLength = 0;
 		size_t pad = 0;
-	} mh;
+		size_t start = 0;		// Head the message was reserved at, a WRAP in front of it included
+		size_t end = 0;			// Head once it is published
+	};
+
+	enum MSGID { DATA = 1, WRAP = 2, FRAGMENT = 3, REMAP = 4 };
+
+	// Starts the payload of every FRAGMENT, messages too large for the buffer are sent as a run of these
+	struct FragmentHeader
+	{
+		size_t sequence = 0;	// Message number, the same for all fragments of one message
+		size_t offset = 0;		// Where this fragment goes in the whole message
+		size_t totalLength = 0;	// Length of the whole message
+		size_t pad = 0;
+	};
+
+	// Per process state of one lane, every lane is a ring of its own
+	struct Lane
+	{
+		LaneHeader* lh = nullptr;
+		char* buffer = nullptr;			// Start of the circular buffer in this process
+
+		// Receiver side reassembly of a fragmented message
+		std::vector<char> reassembly;
+		size_t reassemblySequence = 0;
+		size_t reassembled = 0;			// Bytes received so far
+		bool reassemblyReady = false;	// Whole message received, handed out by the next peek/recvBatch
+
+		size_t peekedTail = 0;		// Tail of the message between peek() and release()
+
+		// Producer side watch on the slowest BROADCAST reader while the buffer is full
+		int watchedReader = -1;
+		size_t watchedTail = 0;
+		std::chrono::steady_clock::time_point watchedSince;
+	};
+
+	std::vector<Lane> lanes;
+	unsigned int peekedLane = 0;	// Lane of the message between peek() and release()
+
+	int reader = -1;				// BROADCAST: reader slot of this process, taken on the first receive
+	bool readerFull = false;		// BROADCAST: every reader slot was taken, reported once
+	unsigned int joinCount = 0;		// BROADCAST: times this process took or got back its reader slot
 
+	std::string name;				// Secret of generation 0, generation n is name@n
+	std::unique_ptr<ComLib> origin;	// Generation 0 while a later one is in use, kept so late joiners can find that one
+	std::vector<std::unique_ptr<ComLib>> retired;	// Generations this producer replaced, kept until their readers moved on
+	bool created = false;			// This process created the segment
+	size_t resizeMin = 0;			// Limits set by autoResize, resizing is off while resizeMax is 0
+	size_t resizeMax = 0;
+	size_t peakUse = 0;				// Most bytes a lane needed since peakSince, decides when to shrink
+	std::chrono::steady_clock::time_point peakSince;
+
+#if defined(_WIN32)
 	HANDLE hMutex;
+#else
+	// Lives in the mapping between SharedHeader and the circular buffer
+	struct SharedMutex
+	{
+		pthread_mutex_t mutex;
+		std::atomic<unsigned int> ready;	// Set once the creator has initialized the mutex and header
+		unsigned int users;					// Attached processes, the last one to leave unlinks the segment
+	};
+
+	pthread_mutex_t* hMutex;
+#endif
+
+	// Maps the segment named secret as it is, generation is recorded in it if this process creates it
+	ComLib(const std::string& secret, const size_t& buffSize, const MODE mode, const bool mirrored, const unsigned int laneCount, const unsigned int generation);
+
+	static unsigned int clampLanes(const unsigned int laneCount);
+	void initHeader(const size_t bufferOffset, const size_t bufferSize, const MODE mode, const bool mirrored, const unsigned int laneCount, const unsigned int generation);
+	bool mapMirror();
+	void mapLanes();
+
+	bool lock();
+	void unlock();
+
+	Lane& lane(const unsigned int index);
+	Lane& owner(const char* data);
+
+	bool attach();
+	std::atomic<size_t>& tailOf(Lane& l);
+	size_t reclaim(Lane& l);
+	void dropSlowest(Lane& l);
+
+	MsgHeader* header(const Lane& l, const size_t position) const;
+	MsgHeader* front(Lane& l, size_t& tail, size_t& head);
+	static size_t messageSize(const size_t length);
+
+	bool claim(Lane& l, const size_t totalSize, size_t& head, size_t& tail, size_t& skip);
+	char* allocate(Lane& l, const size_t length, const size_t id);
+	bool publish(Lane& l, MsgHeader* mh);
+	bool assemble(Lane& l, size_t& tail, const size_t head);
+	bool sendFragmented(Lane& l, const char* msg, const size_t length);
+
+	std::unique_ptr<ComLib> attachGeneration(const unsigned int generation, const size_t buffSize);
+	std::unique_ptr<ComLib> nextGeneration();
+	std::unique_ptr<ComLib> retire(const size_t buffSize);
+	std::unique_ptr<ComLib> adopt(std::unique_ptr<ComLib> next);
+	void prune();
+	size_t wanted(Lane& l, const size_t totalSize);
+	bool enter(Lane& l, const size_t totalSize);
+	bool drained();
+	bool follow();
+
+	const char* peekLane(Lane& l, size_t& length);
+	size_t drainLane(Lane& l, char* msgs, const size_t capacity, size_t& used, size_t* lengths, const size_t maxCount);
 
 public:
-	ComLib(const std::string& secret, const size_t& buffSize);
+	// mirrored: map the buffer twice back-to-back so every message is one contiguous span,
+	// whatever its offset. The buffer is rounded up to the page (allocation granularity on Windows) size.
+	// laneCount: priority lanes, each a buffer of buffSize. Receiving always empties lane 0 first, then lane 1...
+	ComLib(const std::string& secret, const size_t& buffSize, const MODE mode = LOCKED, const bool mirrored = false, const unsigned int laneCount = 1);
 
-	bool send(const void* msg, const size_t length);
+	// Messages too large for the buffer in one piece are split into fragments and reassembled by the receiver.
+	// While sending those, send waits for the consumer to make room and gives up if it stops reading.
+	// Messages keep their order within a lane, not across lanes. A lane the segment does not have means its last one.
+	bool send(const void* msg, const size_t length, const unsigned int lane = 0);
+
+	// Zero-copy send: reserve room for length bytes in the buffer, write straight into it and commit.
+	// commit may publish fewer bytes than reserved. reserve returns nullptr if the message does not fit.
+	// MPSC: any number of threads can be between reserve and commit at once, commit waits for earlier reservations,
+	// so a thread holding more than one commits them in the order it reserved them. Every reservation has to be
+	// committed or abandoned within COMLIB_LOCK_TIMEOUT_MS: past that a producer waiting behind it takes it to be
+	// from a producer that is gone and has the consumer skip it, and a commit that comes later is dropped.
+	char* reserve(const size_t length, const unsigned int lane = 0);
+	void commit(char* data, const size_t length);
+
+	// Gives back a reservation without sending anything, the consumer skips its space
+	void abandon(char* data);
+
+	// Zero-copy recv: read-only view of the next message, valid until release().
+	// peek returns nullptr if there is nothing to be read, or a fragmented message has not fully arrived yet.
+	// A fragmented message is viewed in its reassembly buffer instead of in place.
+	// lane, if given, is set to the lane the message came from.
+	const char* peek(size_t& length, unsigned int* lane = nullptr);
+	void release();
 
 	bool recv(char* msg, size_t& length);
 
+	// Drains pending messages back-to-back into msgs under a single acquisition of the ring, lanes in priority order.
+	// Stops when the ring is empty, maxCount messages were read or the next one does not fit in capacity.
+	// Returns the number of messages read, lengths[i] holds the size of message i.
+	size_t recvBatch(char* msgs, const size_t capacity, size_t* lengths, const size_t maxCount);
+
+	// Producer side: bytes published in a lane so far, and bytes every reader of it is done with.
+	// Anything a message refers to outside the buffer can be reused once consumed() has passed written() at send.
+	size_t written(const unsigned int lane);
+	size_t consumed(const unsigned int lane);
+
+	// Length of the next message without consuming it, 0 if there is nothing to be read.
+	// Use it to size the buffer for recv/recvBatch when messages can be larger than it.
 	size_t nextLength();
 
+	// BROADCAST: times this process started reading, on its first receive and again after every drop.
+	// Whatever was sent before a join was not received, a consumer that keeps state can ask for it again.
+	unsigned int joins() const;
+
+	// Counters kept in the segment by every attached process, readable from any of them
+	Stats stats() const;
+
+	// Producer side: moves every lane to a new segment of buffSize, a new generation named secret@n.
+	// The old generation ends in a REMAP marker in every lane. Consumers read it up to the markers and move on,
+	// so nothing in flight is lost and neither side reconnects. False if what is in use would not fit.
+	// Not in MPSC, whose producer threads share the mapping.
+	bool resize(const size_t buffSize);
+
+	// Producer side: resize by itself, lanes grow up to maxSize under load and shrink down to minSize when idle
+	void autoResize(const size_t minSize, const size_t maxSize);
+
+	// Moves on to the generation in use without reading anything, for a process that only watches stats().
+	// Senders and receivers do that by themselves.
+	void refresh();
+
+	// Whether the segment has been created, lets a monitoring tool attach without creating it
+	static bool exists(const std::string& secret);
+
+#if !defined(_WIN32)
+	// Unlinks the shared memory object name if handle is still the object under that name. For a segment whose
+	// creator never finished it (ComLib, BlobHeap, StateTable), a process that replaced it already is left alone.
+	static void unlinkStale(const std::string& name, const int handle);
+#endif
+
 	~ComLib();
 };
\ No newline at end of file
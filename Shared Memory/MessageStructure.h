@@ -1,25 +1,73 @@
 #pragma once
 
-#include "ComLib.h"
+#include "Transport.h"
+#include "StateTable.h"
+#include "BlobHeap.h"
+#include <cstring>
+#include <type_traits>
 // 1 << 10 // 1024 // 1kb
 // 1 << 20 // 1048576 // 1048kb // 1mb
 // 1 << 30 // 1073741824 // 1073741kb // 1073mb // 1gb
 
-#define BUFFERSIZE 8<<20 // 1048 MB
+#define BUFFERSIZE 1<<20 // 1 MB per lane to start with, the plugin grows the ring up to BUFFERSIZE_MAX under load
+#define BUFFERSIZE_MAX 64<<20 // 64 MB
 #define MSGSIZE 5<<20 // 5 MB
+#define MSGBATCH 4096 // Max messages drained per frame
+#define STATESLOTS 4096 // Camera + live transforms, a removed transform frees its slot
+#define STATE_CAMERA NODE_NONE // Slot tag of the active camera, transforms are tagged with their NodeHandle
+#define BLOBHEAPSIZE 64<<20 // 64 MB
+#define BLOBBLOCKSIZE 64<<10 // 64 KB
+#define FEEDBACK_WINDOW 32 // Bulk messages a renderer takes before the plugin waits for its acks
+#define FEEDBACK_KEEPALIVE_MS 500 // Longest a renderer goes without acking
+#define FEEDBACK_TIMEOUT_MS 2000 // A renderer not heard from for this long is gone
+#define PACKETSIZE 64<<10 // 64 KB, most a PACKET of small messages grows to before it is sent
 
-ComLib comlib("MayaToRender", BUFFERSIZE);
+// Small interactive edits (material tweaks) go ahead of meshes and node adds/removes
+enum LANE { LANE_INTERACTIVE, LANE_BULK };
+
+// The plugin is the only producer, any number of renderers can attach and each gets every message.
+// Mirrored so meshes can always be read in place, wherever they land in the buffer.
+// Shared memory unless MAYARENDER_TRANSPORT names a socket, e.g. tcp://*:5555 for Maya and tcp://mayahost:5555 for the renderer.
+// Renderers reply through "RenderToMaya" (sFeedback).
+Transport comlib("MayaToRender", BUFFERSIZE, ComLib::BROADCAST, true, 2, "RenderToMaya");
 
 char* msg = new char[MSGSIZE];
 size_t msgSize = 0;
 
-enum ACTIVITY { ADD, UPDATE, REMOVE };
-enum NODETYPE { MESH, MATERIAL, CAMERA, TRANSFORM, LIGHT };
+// Wire format of every struct below, bumped whenever one of them changes.
+// Renderers skip messages of another version instead of misreading them.
+#define SCHEMA_VERSION 8
+
+enum ACTIVITY : unsigned char { ADD, UPDATE, REMOVE, DELTA, LINK, PACKET };
+enum NODETYPE : unsigned char { MESH, MATERIAL, CAMERA, TRANSFORM, LIGHT };
+
+// The plugin gives every node a handle the first time it sends it and uses it in every message after.
+// Handles count up from 1 and are never reused within a plugin session, so renderers index their tables by them.
+// ADD binds a handle to the node's uuid, a renderer that has the uuid under another handle moves it over.
+typedef unsigned int NodeHandle;
+#define NODE_NONE 0 // No node, e.g. the camera or a mesh without a material
+
+// Everything that goes between processes has a fixed layout, same on both sides whatever the compiler
+#pragma pack(push, 4)
+
+struct sUuid {
+	unsigned char bytes[16];	// Binary MUuid
+};
 
 struct sHeader {
+	unsigned short version = SCHEMA_VERSION;
 	ACTIVITY activity;			// Add / Update / Remove
 	NODETYPE type;				// Mesh / Camera / Transform etc
-	char nodeID[37];			// uuid[36] + '\0'[1]
+	NodeHandle node;			// NODE_NONE for the camera
+};
+// ADD: the node's sUuid follows the header, then the message itself (MessageLayout)
+// LINK: a mesh was given another material and nothing else changed, its NodeHandle follows (NODE_NONE for none)
+
+// PACKET: small messages of one callback burst (removes, transform adds and updates, links) sent as one message,
+// type and node of its header are unused. Each record is its size as an int and a whole message of its own,
+// padded to 4 bytes (packetRecordSize). Renderers apply them in order as if they had come one by one.
+struct sPacket {
+	int recordCount;			// Records that follow
 };
 
 struct sCamera {
@@ -28,19 +76,54 @@ struct sCamera {
 	float up[3];				// Up
 	float fovy;					// Fovy
 	bool projection;			// Projection
+	unsigned char pad[3];
 };
 
+// Meshes are indexed: one vertex per Maya vertex, split where its corners have different uvs or normals.
+// The arrays hold positions, uvs and normals of every vertex, then 3 indices per triangle (meshArraysSize).
+#define SHORTINDEX_VERTICES 65536 // Most vertices a mesh with 16 bit indices can have, 32 bit above
+
+// How the vertex arrays are stored, both go to the GPU as they are and the vertex shader reads either.
+// VERTEX_FLOAT:     3 floats of position, 2 of uv and 3 of normal, 32 bytes per vertex.
+// VERTEX_QUANTIZED: 4 unsigned shorts of position from boundsMin (0) to boundsMax (65535), the 4th is padding,
+//                   2 half floats of uv and 2 unsigned shorts of octahedral normal, 16 bytes per vertex.
+enum VERTEXFORMAT : unsigned char { VERTEX_FLOAT, VERTEX_QUANTIZED };
+
 //TODO: merge mesh structs into one
 struct sMeshHeader {
 	int vertexCount;			// Number of vertices stored in arrays
-	int triangleCount;			// Number of triangles stored (indexed or not)	
-	char connectedMatID[37];	// uuid[36] + '\0'[1]
+	int triangleCount;			// Number of triangles in the indices
+	int indexSize;				// Bytes per index, 2 or 4
+	NodeHandle material;		// Connected material, NODE_NONE if it has none
+	VERTEXFORMAT format;		// Float / Quantized
+	unsigned char pad[3];
+	float boundsMin[3];			// VERTEX_QUANTIZED: bounding box the positions are quantized against
+	float boundsMax[3];
+	int compressedSize;			// Inline arrays only: bytes of them DEFLATE compressed (sdefl), 0 if they are not
+	BlobHandle blob;			// Vertex arrays in blobHeap, if blob.length is 0 they follow the header instead
+};
+
+// DELTA: new positions and normals of some vertices of a mesh whose faces, uvs and normal ids are the same as
+// in its last ADD or UPDATE, in the format and bounds that sent it. Always inline, the sVertexRange follow the
+// sMeshDelta, then the positions of every range one after the other, then their normals (meshDeltaSize).
+struct sMeshDelta {
+	int vertexCount;			// Of the whole mesh, a renderer that has another count asks for the mesh again
+	int rangeCount;				// sVertexRange that follow
+	int rangeVertices;			// Vertices of every range together
+	VERTEXFORMAT format;		// The mesh was last sent whole as
+	unsigned char pad[3];
+};
+
+struct sVertexRange {
+	int first;					// First vertex of the range
+	int count;
 };
 
 struct sMeshData {
 	float* posXYZ;				// Vertex position (XYZ - 3 components per vertex) (shader-location = 0)
 	float* UV;					// Vertex texture coordinates (UV - 2 components per vertex) (shader-location = 1)
 	float* norXYZ;				// Vertex normals (XYZ - 3 components per vertex) (shader-location = 2)
+	void* indices;				// Triangle corners (3 per triangle, indexSize bytes each)
 };
 
 struct sTransform {
@@ -52,8 +135,31 @@ struct sTransform {
 
 struct sMaterial {
 	float color[3];
-	int pathSize;
-	char *texturePath;
+	int pathSize;				// Texture path that follows, '\0' included, 0 without a texture
+};
+
+// Renderer to plugin, through comlib.reply()
+// HELLO:  sent whenever the renderer starts reading (comlib.joins()), followed by every node it has.
+//         The plugin sends the nodes it is missing and removes the ones that are gone.
+// RESYNC: followed by nodes the renderer found missing, e.g. the material of a new mesh. The plugin sends them again.
+// ACK:    bulk lane messages read since the last ack. Each gives back a credit, the plugin holds mesh updates
+//         back while a renderer is out of credits and sends only the newest once it has some again.
+enum FEEDBACK : unsigned int { HELLO, RESYNC, ACK };
+
+struct sFeedback {
+	FEEDBACK kind;				// Hello / Resync / Ack
+	unsigned int renderer;		// Picked by the renderer at start, tells renderers apart
+	int credits;				// HELLO: bulk messages it takes at once, ACK: bulk messages read
+	int nodeCount;				// sNodeRef that follow
+};
+
+// HELLO sends both handle and uuid, handles from another plugin session do not match the uuid and are sent again.
+// RESYNC only knows the handle, the uuid is zero.
+struct sNodeRef {
+	NODETYPE type;
+	unsigned char pad[3];
+	NodeHandle node;
+	sUuid uuid;
 };
 
 // Not in use
@@ -61,4 +167,312 @@ struct sLight {
 	float position[3];
 	float intensity;
 	int color[3];
-};
\ No newline at end of file
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(sUuid) == 16 && sizeof(sHeader) == 8 && sizeof(sNodeRef) == 24, "Wire structs must not change size between compilers");
+static_assert(sizeof(sCamera) == 44 && sizeof(sTransform) == 64 && sizeof(sMaterial) == 16 && sizeof(sFeedback) == 16 && sizeof(sPacket) == 4, "Wire structs must not change size between compilers");
+static_assert(sizeof(sMeshHeader) == 48 + sizeof(BlobHandle) && sizeof(sMeshDelta) == 16 && sizeof(sVertexRange) == 8, "Wire structs must not change size between compilers");
+
+// Bytes a record of size bytes takes in a PACKET, its size included
+size_t packetRecordSize(const size_t size)
+{
+	return (sizeof(int) + size + 3) & ~(size_t)3;
+}
+
+// Bytes of position, uv and normal of one vertex
+size_t vertexSize(const VERTEXFORMAT format)
+{
+	if (format == VERTEX_QUANTIZED)
+		return sizeof(unsigned short) * (4 + 2 + 2);
+
+	return sizeof(float) * (3 + 2 + 3);
+}
+
+// Bytes of a mesh's arrays, blob or inline
+size_t meshArraysSize(const sMeshHeader& header)
+{
+	return vertexSize(header.format) * header.vertexCount + (size_t)header.indexSize * header.triangleCount * 3;
+}
+
+// Bytes of position and normal of one vertex, what a DELTA carries of it
+size_t deltaVertexSize(const VERTEXFORMAT format)
+{
+	if (format == VERTEX_QUANTIZED)
+		return sizeof(unsigned short) * (4 + 2);
+
+	return sizeof(float) * (3 + 3);
+}
+
+// Bytes of a DELTA after its sMeshDelta
+size_t meshDeltaSize(const sMeshDelta& delta)
+{
+	return sizeof(sVertexRange) * delta.rangeCount + deltaVertexSize(delta.format) * delta.rangeVertices;
+}
+
+// Typed messages
+//----------------------------------------------------------------------------------
+// Every message is an sHeader, the sUuid of an ADD, the struct its type and activity have (MessageSpec::Fixed)
+// and a variable section after it that the struct gives the size of. Senders and handlers both go through
+// MessageSpec, one that writes or reads another struct than the message has does not compile.
+
+struct sEmpty {};				// No struct after the header
+
+// Messages that have no spec do not exist, e.g. a camera ADD
+template <NODETYPE Type, ACTIVITY Activity> struct MessageSpec;
+
+// Variable sections with a negative count in their struct are too large for any message
+#define VARIABLE_INVALID ((size_t)-1)
+
+struct MeshSpec {
+	using Fixed = sMeshHeader;	// Arrays follow unless they are in the blob heap
+	static size_t variableSize(const sMeshHeader& header)
+	{
+		if (header.vertexCount < 0 || header.triangleCount < 0 || header.compressedSize < 0)
+			return VARIABLE_INVALID;
+
+		// The only index sizes there are, any other would be read as one of them past the arrays
+		if (header.indexSize != sizeof(unsigned short) && header.indexSize != sizeof(unsigned int))
+			return VARIABLE_INVALID;
+
+		return (header.blob.length > 0) ? 0 : (header.compressedSize > 0) ? header.compressedSize : meshArraysSize(header);
+	}
+};
+
+struct DeltaSpec {
+	using Fixed = sMeshDelta;	// Ranges, positions and normals follow
+	static size_t variableSize(const sMeshDelta& delta) { return (delta.rangeCount < 0 || delta.rangeVertices < 0) ? VARIABLE_INVALID : meshDeltaSize(delta); }
+};
+
+struct LinkSpec {
+	using Fixed = NodeHandle;	// Material of the mesh
+	static size_t variableSize(const NodeHandle&) { return 0; }
+};
+
+struct TransformSpec {
+	using Fixed = sTransform;
+	static size_t variableSize(const sTransform&) { return 0; }
+};
+
+struct CameraSpec {
+	using Fixed = sCamera;
+	static size_t variableSize(const sCamera&) { return 0; }
+};
+
+struct MaterialSpec {
+	using Fixed = sMaterial;	// Texture path follows
+	static size_t variableSize(const sMaterial& material) { return (material.pathSize < 0) ? VARIABLE_INVALID : material.pathSize; }
+};
+
+struct RemoveSpec {
+	using Fixed = sEmpty;
+	static size_t variableSize(const sEmpty&) { return 0; }
+};
+
+template <> struct MessageSpec<MESH, ADD> : MeshSpec {};
+template <> struct MessageSpec<MESH, UPDATE> : MeshSpec {};
+template <> struct MessageSpec<MESH, DELTA> : DeltaSpec {};
+template <> struct MessageSpec<MESH, LINK> : LinkSpec {};
+template <> struct MessageSpec<TRANSFORM, ADD> : TransformSpec {};
+template <> struct MessageSpec<TRANSFORM, UPDATE> : TransformSpec {};
+template <> struct MessageSpec<CAMERA, UPDATE> : CameraSpec {};
+template <> struct MessageSpec<MATERIAL, ADD> : MaterialSpec {};
+template <> struct MessageSpec<MATERIAL, UPDATE> : MaterialSpec {};
+template <NODETYPE Type> struct MessageSpec<Type, REMOVE> : RemoveSpec {};
+
+// Where the parts of a message are
+template <NODETYPE Type, ACTIVITY Activity>
+struct MessageLayout
+{
+	using Fixed = typename MessageSpec<Type, Activity>::Fixed;
+
+	static_assert(std::is_trivially_copyable<Fixed>::value, "Message structs are copied as bytes");
+
+	static constexpr size_t fixedOffset = sizeof(sHeader) + ((Activity == ADD) ? sizeof(sUuid) : 0);
+	static constexpr size_t fixedSize = std::is_empty<Fixed>::value ? 0 : sizeof(Fixed);
+	static constexpr size_t variableOffset = fixedOffset + fixedSize;
+
+	// Bytes of the whole message
+	static size_t size(const Fixed& fixed)
+	{
+		return variableOffset + MessageSpec<Type, Activity>::variableSize(fixed);
+	}
+};
+
+// A message as it is read, the variable section in place
+template <NODETYPE Type, ACTIVITY Activity>
+struct MessageView
+{
+	sHeader header;
+	sUuid uuid;					// ADD only, zero otherwise
+	typename MessageLayout<Type, Activity>::Fixed fixed;
+	const char* variable;
+	size_t variableSize;
+};
+
+// Writes the header, the uuid of an ADD and the struct of a message, then the variable section if there is one.
+// Without, it is left for the caller to write in place at MessageLayout::variableOffset.
+// Returns the size of the whole message, 0 if it does not fit in capacity.
+template <NODETYPE Type, ACTIVITY Activity>
+size_t encodeMessage(char* data, const size_t capacity, const NodeHandle node, const sUuid& uuid, const typename MessageLayout<Type, Activity>::Fixed& fixed, const void* variable = nullptr)
+{
+	using Layout = MessageLayout<Type, Activity>;
+
+	const size_t size = Layout::size(fixed);
+
+	if (size > capacity)
+		return 0;
+
+	sHeader header{};
+	header.activity = Activity;
+	header.type = Type;
+	header.node = node;
+
+	memcpy(data, &header, sizeof(sHeader));
+
+	if (Activity == ADD)
+		memcpy(data + sizeof(sHeader), &uuid, sizeof(sUuid));
+
+	if (Layout::fixedSize > 0)
+		memcpy(data + Layout::fixedOffset, &fixed, Layout::fixedSize);
+
+	if (variable != nullptr)
+		memcpy(data + Layout::variableOffset, variable, size - Layout::variableOffset);
+
+	return size;
+}
+
+// Reads a message of Type and Activity, false if it is another or shorter than its struct says it is
+template <NODETYPE Type, ACTIVITY Activity>
+bool decodeMessage(const char* data, const size_t size, MessageView<Type, Activity>& message)
+{
+	using Layout = MessageLayout<Type, Activity>;
+
+	message = MessageView<Type, Activity>{};
+
+	if (size < Layout::variableOffset)
+		return false;
+
+	memcpy(&message.header, data, sizeof(sHeader));
+
+	if (message.header.version != SCHEMA_VERSION || message.header.type != Type || message.header.activity != Activity)
+		return false;
+
+	if (Activity == ADD)
+		memcpy(&message.uuid, data + sizeof(sHeader), sizeof(sUuid));
+
+	if (Layout::fixedSize > 0)
+		memcpy(&message.fixed, data + Layout::fixedOffset, Layout::fixedSize);
+
+	message.variable = data + Layout::variableOffset;
+	message.variableSize = MessageSpec<Type, Activity>::variableSize(message.fixed);
+
+	return message.variableSize <= size - Layout::variableOffset;
+}
+
+// A REMOVE is the same for every type, this one takes a type only known at run time
+size_t encodeRemove(char* data, const size_t capacity, const NODETYPE type, const NodeHandle node)
+{
+	if (capacity < sizeof(sHeader))
+		return 0;
+
+	sHeader header{};
+	header.activity = REMOVE;
+	header.type = type;
+	header.node = node;
+
+	memcpy(data, &header, sizeof(sHeader));
+
+	return sizeof(sHeader);
+}
+
+// Where the records of a PACKET start
+constexpr size_t packetRecordsOffset()
+{
+	return sizeof(sHeader) + sizeof(sPacket);
+}
+
+// Header and sPacket of a PACKET of recordCount records, written in front of them
+void encodePacket(char* data, const int recordCount)
+{
+	sHeader header{};
+	header.activity = PACKET;
+
+	sPacket packet{};
+	packet.recordCount = recordCount;
+
+	memcpy(data, &header, sizeof(sHeader));
+	memcpy(data + sizeof(sHeader), &packet, sizeof(sPacket));
+}
+
+// Records of a PACKET one after the other, each a whole message of its own
+struct PacketReader
+{
+	const char* data;
+	size_t size;
+	size_t offset = packetRecordsOffset();
+	int recordsLeft = 0;
+
+	PacketReader(const char* data, const size_t size) : data(data), size(size)
+	{
+		sPacket packet{};
+
+		if (size >= packetRecordsOffset())
+		{
+			memcpy(&packet, data + sizeof(sHeader), sizeof(sPacket));
+			recordsLeft = packet.recordCount;
+		}
+	}
+
+	// The next record, false once there are none left or the next one runs past the packet
+	bool next(const char*& record, size_t& recordSize)
+	{
+		int length = 0;
+
+		if (recordsLeft <= 0 || offset + sizeof(int) > size)
+			return false;
+
+		memcpy(&length, data + offset, sizeof(int));
+
+		if (length < (int)sizeof(sHeader) || offset + sizeof(int) + length > size)
+			return false;
+
+		record = data + offset + sizeof(int);
+		recordSize = length;
+
+		offset += packetRecordSize(length);
+		recordsLeft--;
+
+		return true;
+	}
+};
+
+
+// Latest camera and transform values, tagged with their handle (STATE_CAMERA for the camera).
+// The renderer reads them once per frame instead of replaying every update through comlib.
+// Over a socket each side has a table of its own and the plugin sends updates to the renderer's.
+StateTable stateTable(comlib.segment("MayaToRenderState"), STATESLOTS, (sizeof(sTransform) > sizeof(sCamera)) ? sizeof(sTransform) : sizeof(sCamera));
+
+// Vertex arrays of meshes, only their handle goes through comlib.
+// The plugin frees them once every renderer has read past the message (comlib.consumed).
+BlobHeap blobHeap(comlib.segment("MayaToRenderHeap"), BLOBHEAPSIZE, BLOBBLOCKSIZE);
+
+// Feedback with its node list, false if it could not be sent (no plugin yet, or it is not reading)
+bool sendFeedback(const FEEDBACK kind, const unsigned int renderer, const int credits, const std::vector<sNodeRef>& nodes)
+{
+	sFeedback feedback{};
+	feedback.kind = kind;
+	feedback.renderer = renderer;
+	feedback.credits = credits;
+	feedback.nodeCount = (int)nodes.size();
+
+	std::vector<char> data(sizeof(sFeedback) + sizeof(sNodeRef) * nodes.size());
+
+	memcpy(data.data(), &feedback, sizeof(sFeedback));
+
+	if (!nodes.empty())
+		memcpy(data.data() + sizeof(sFeedback), nodes.data(), sizeof(sNodeRef) * nodes.size());
+
+	return comlib.reply(data.data(), data.size());
+}
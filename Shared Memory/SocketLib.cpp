@@ -0,0 +1,1011 @@
+#if defined(_WIN32)
+// Before windows.h, which would otherwise pull in the old winsock.h
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#endif
+
+#include "SocketLib.h"
+#include <thread>
+
+#if defined(_WIN32)
+typedef SOCKET NativeSocket;
+#else
+typedef int NativeSocket;
+#endif
+
+// A chunk of a vectored write
+struct Chunk
+{
+	const char* data;
+	size_t length;
+};
+
+#if defined(_WIN32)
+static void closeSocket(intptr_t s)
+{
+	closesocket((SOCKET)s);
+}
+
+static int socketError()
+{
+	return WSAGetLastError();
+}
+
+static bool wouldBlock()
+{
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+static void setNonBlocking(intptr_t s)
+{
+	u_long on = 1;
+	ioctlsocket((SOCKET)s, FIONBIO, &on);
+}
+
+// Bytes written, 0 if the socket is full, -1 if it failed
+static long long writeChunks(intptr_t s, const Chunk* chunks, const size_t count)
+{
+	WSABUF buffers[2 * COMLIB_MAX_LANES + 2];
+	DWORD n = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		buffers[n].buf = const_cast<char*>(chunks[i].data);
+		buffers[n].len = (ULONG)chunks[i].length;
+		n++;
+	}
+
+	DWORD sent = 0;
+
+	if (WSASend((SOCKET)s, buffers, n, &sent, 0, NULL, NULL) == SOCKET_ERROR)
+		return wouldBlock() ? 0 : -1;
+
+	return sent;
+}
+
+static long long readSome(intptr_t s, char* data, const size_t length)
+{
+	const int n = ::recv((SOCKET)s, data, (int)length, 0);
+
+	if (n == SOCKET_ERROR)
+		return wouldBlock() ? 0 : -1;
+
+	return (n == 0) ? -1 : n; // 0 is the other end closing
+}
+#else
+static void closeSocket(intptr_t s)
+{
+	close((int)s);
+}
+
+static int socketError()
+{
+	return errno;
+}
+
+static bool wouldBlock()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+static void setNonBlocking(intptr_t s)
+{
+	fcntl((int)s, F_SETFL, fcntl((int)s, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static long long writeChunks(intptr_t s, const Chunk* chunks, const size_t count)
+{
+	iovec buffers[2 * COMLIB_MAX_LANES + 2];
+
+	for (size_t i = 0; i < count; i++)
+	{
+		buffers[i].iov_base = const_cast<char*>(chunks[i].data);
+		buffers[i].iov_len = chunks[i].length;
+	}
+
+	msghdr message {};
+	message.msg_iov = buffers;
+	message.msg_iovlen = count;
+
+	// sendmsg instead of writev, a consumer that went away must not raise SIGPIPE in the host application
+#if defined(MSG_NOSIGNAL)
+	const ssize_t sent = sendmsg((int)s, &message, MSG_NOSIGNAL);
+#else
+	const ssize_t sent = sendmsg((int)s, &message, 0);
+#endif
+
+	if (sent == -1)
+		return wouldBlock() ? 0 : -1;
+
+	return sent;
+}
+
+static long long readSome(intptr_t s, char* data, const size_t length)
+{
+	const ssize_t n = ::recv((int)s, data, length, 0);
+
+	if (n == -1)
+		return wouldBlock() ? 0 : -1;
+
+	return (n == 0) ? -1 : n;
+}
+#endif
+
+// Socket for address, bound and listening or connected. -1 if that failed.
+static intptr_t openSocket(const std::string& address, const bool listening)
+{
+	intptr_t s = -1;
+
+	if (address.compare(0, 7, "unix://") == 0)
+	{
+		const std::string path = address.substr(7);
+
+		sockaddr_un sa {};
+		sa.sun_family = AF_UNIX;
+
+		if (path.size() >= sizeof(sa.sun_path)) {
+			printf("Socket path is too long (%s).\n", path.c_str());
+			return -1;
+		}
+
+		memcpy(sa.sun_path, path.c_str(), path.size() + 1);
+
+		s = (intptr_t)socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (s == -1)
+			return -1;
+
+		if (listening)
+		{
+			// Left behind by a producer that did not shut down
+#if defined(_WIN32)
+			DeleteFileA(path.c_str());
+#else
+			unlink(path.c_str());
+#endif
+
+			if (bind((NativeSocket)s, (sockaddr*)&sa, sizeof(sa)) != 0 || ::listen((NativeSocket)s, SOMAXCONN) != 0) {
+				printf("Could not listen on %s (%d).\n", address.c_str(), socketError());
+				closeSocket(s);
+				return -1;
+			}
+		}
+		else if (::connect((NativeSocket)s, (sockaddr*)&sa, sizeof(sa)) != 0)
+		{
+			closeSocket(s);
+			return -1;
+		}
+	}
+	else if (address.compare(0, 6, "tcp://") == 0)
+	{
+		const std::string hostPort = address.substr(6);
+		const size_t colon = hostPort.rfind(':');
+
+		if (colon == std::string::npos) {
+			printf("Socket address has no port (%s).\n", address.c_str());
+			return -1;
+		}
+
+		// An empty host or * listens on every interface
+		std::string host = hostPort.substr(0, colon);
+		const std::string port = hostPort.substr(colon + 1);
+
+		if (host == "*")
+			host.clear();
+
+		addrinfo hints {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = listening ? AI_PASSIVE : 0;
+
+		addrinfo* found = nullptr;
+
+		if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0) {
+			printf("Could not resolve %s.\n", address.c_str());
+			return -1;
+		}
+
+		for (addrinfo* ai = found; ai != nullptr; ai = ai->ai_next)
+		{
+			s = (intptr_t)socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+			if (s == -1)
+				continue;
+
+			if (listening)
+			{
+				// The port can be reused straight away when Maya is restarted
+				int on = 1;
+				setsockopt((NativeSocket)s, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+
+				if (bind((NativeSocket)s, ai->ai_addr, (int)ai->ai_addrlen) == 0 && ::listen((NativeSocket)s, SOMAXCONN) == 0)
+					break;
+			}
+			else if (::connect((NativeSocket)s, ai->ai_addr, (int)ai->ai_addrlen) == 0)
+			{
+				break;
+			}
+
+			closeSocket(s);
+			s = -1;
+		}
+
+		freeaddrinfo(found);
+
+		if (s == -1 && listening)
+			printf("Could not listen on %s (%d).\n", address.c_str(), socketError());
+	}
+	else
+	{
+		printf("Unknown socket address %s, expected tcp://host:port or unix://path.\n", address.c_str());
+		return -1;
+	}
+
+	if (s == -1 || listening)
+		return s;
+
+	// Messages are batched by this side already, do not let the stack hold them back as well
+	if (address.compare(0, 6, "tcp://") == 0)
+	{
+		int on = 1;
+		setsockopt((NativeSocket)s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+	}
+
+	return s;
+}
+
+SocketLib::SocketLib(const std::string& address, const size_t& buffSize, const unsigned int laneCount)
+	: address(address), buffSize(buffSize), laneCount((laneCount < 1) ? 1 : (laneCount > COMLIB_MAX_LANES) ? COMLIB_MAX_LANES : laneCount)
+{
+#if defined(_WIN32)
+	WSADATA wsa;
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+		printf("Could not start winsock (%d).\n", WSAGetLastError());
+		exit(0);
+	}
+#endif
+
+	lastAttempt = std::chrono::steady_clock::now() - std::chrono::milliseconds(SOCKETLIB_RETRY_MS);
+}
+
+size_t SocketLib::frameSize(const size_t length)
+{
+	return sizeof(FrameHeader) + ((length + 7) & ~size_t(7));
+}
+
+bool SocketLib::listen()
+{
+	if (listener != -1)
+		return true;
+
+	// Not every call if the address is taken, the reason has been printed already
+	const auto now = std::chrono::steady_clock::now();
+
+	if (now - lastAttempt < std::chrono::milliseconds(SOCKETLIB_RETRY_MS))
+		return false;
+
+	lastAttempt = now;
+	listener = openSocket(address, true);
+
+	if (listener == -1)
+		return false;
+
+	setNonBlocking(listener);
+	return true;
+}
+
+void SocketLib::accept()
+{
+	while (true)
+	{
+		const intptr_t s = (intptr_t)::accept((NativeSocket)listener, nullptr, nullptr);
+
+		if (s == -1)
+			return;
+
+		if (address.compare(0, 6, "tcp://") == 0)
+		{
+			int on = 1;
+			setsockopt((NativeSocket)s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+		}
+
+#if defined(SO_NOSIGPIPE)
+		int on = 1;
+		setsockopt((NativeSocket)s, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+		setNonBlocking(s);
+
+		Connection c;
+		c.socket = s;
+		connections.push_back(std::move(c));
+	}
+}
+
+bool SocketLib::connect()
+{
+	if (server != -1)
+		return true;
+
+	// Not every call, the producer may not be up yet
+	const auto now = std::chrono::steady_clock::now();
+
+	if (now - lastAttempt < std::chrono::milliseconds(SOCKETLIB_RETRY_MS))
+		return false;
+
+	lastAttempt = now;
+	server = openSocket(address, false);
+
+	if (server == -1)
+		return false;
+
+	setNonBlocking(server);
+	joinCount++;
+	return true;
+}
+
+void SocketLib::disconnect(const size_t index)
+{
+	closeSocket(connections[index].socket);
+	connections.erase(connections.begin() + index);
+}
+
+void SocketLib::lose()
+{
+	printf("Lost connection to %s.\n", address.c_str());
+	closeSocket(server);
+	server = -1;
+	stream.clear();
+	outgoing.clear();
+	outgoingOffset = 0;
+}
+
+bool SocketLib::flush(Connection& c)
+{
+	// A frame written halfway is finished first, the other end cannot read anything else before it
+	if (c.partialLane >= 0)
+	{
+		const Chunk chunk = { c.pending[c.partialLane].data() + c.offset[c.partialLane], c.partialEnd - c.offset[c.partialLane] };
+		const long long n = writeChunks(c.socket, &chunk, 1);
+
+		if (n < 0)
+			return false;
+
+		c.offset[c.partialLane] += (size_t)n;
+
+		if (c.offset[c.partialLane] < c.partialEnd)
+			return true;
+
+		c.partialLane = -1;
+	}
+
+	// Then whatever is queued, every lane in one vectored write in priority order
+	Chunk chunks[COMLIB_MAX_LANES];
+	size_t count = 0;
+
+	for (unsigned int i = 0; i < laneCount; i++)
+	{
+		if (c.offset[i] < c.pending[i].size())
+			chunks[count++] = { c.pending[i].data() + c.offset[i], c.pending[i].size() - c.offset[i] };
+	}
+
+	if (count == 0)
+		return true;
+
+	const long long n = writeChunks(c.socket, chunks, count);
+
+	if (n < 0)
+		return false;
+
+	size_t left = (size_t)n;
+
+	for (unsigned int i = 0; i < laneCount; i++)
+	{
+		const size_t queued = c.pending[i].size() - c.offset[i];
+
+		if (queued == 0)
+			continue;
+
+		if (left >= queued) // Lane written out
+		{
+			left -= queued;
+			c.pending[i].clear();
+			c.offset[i] = 0;
+			continue;
+		}
+
+		// Stopped inside this lane, find the end of the frame it stopped in
+		const size_t stop = c.offset[i] + left;
+		size_t frame = c.offset[i];
+
+		while (frame + frameSize(reinterpret_cast<FrameHeader*>(c.pending[i].data() + frame)->length) <= stop)
+			frame += frameSize(reinterpret_cast<FrameHeader*>(c.pending[i].data() + frame)->length);
+
+		if (frame < stop)
+		{
+			c.partialLane = (int)i;
+			c.partialEnd = frame + frameSize(reinterpret_cast<FrameHeader*>(c.pending[i].data() + frame)->length);
+		}
+
+		c.offset[i] = stop;
+		break;
+	}
+
+	// Written frames are dropped from the front once they are most of the queue
+	for (unsigned int i = 0; i < laneCount; i++)
+	{
+		if (c.offset[i] > 0 && c.offset[i] >= c.pending[i].size() / 2)
+		{
+			c.pending[i].erase(c.pending[i].begin(), c.pending[i].begin() + c.offset[i]);
+
+			if ((int)i == c.partialLane)
+				c.partialEnd -= c.offset[i];
+
+			c.offset[i] = 0;
+		}
+	}
+
+	return true;
+}
+
+void SocketLib::queue(Connection& c, const FrameHeader& frame, const char* msg, const size_t written)
+{
+	// The whole frame, header and padding included, with what the socket already took marked as written
+	std::vector<char>& pending = c.pending[frame.lane];
+
+	const size_t start = pending.size();
+	pending.resize(start + frameSize((size_t)frame.length)); // Zero filled, so the padding is as well
+
+	memcpy(pending.data() + start, &frame, sizeof(FrameHeader));
+	memcpy(pending.data() + start + sizeof(FrameHeader), msg, (size_t)frame.length);
+
+	if (written > 0) // Only when nothing was queued, so the frame starts the queue
+	{
+		c.offset[frame.lane] = written;
+		c.partialLane = (int)frame.lane;
+		c.partialEnd = pending.size();
+	}
+}
+
+bool SocketLib::room(const unsigned int lane, const size_t total)
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	// Every consumer needs room, so either all of them get the message or none does
+	for (size_t i = 0; i < connections.size(); )
+	{
+		Connection& c = connections[i];
+
+		if (!flush(c))
+		{
+			printf("Consumer disconnected.\n");
+			disconnect(i);
+			continue;
+		}
+
+		const size_t queued = c.pending[lane].size() - c.offset[lane];
+
+		if (queued > 0 && queued + total > buffSize)
+		{
+			if (!c.stalled)
+			{
+				c.stalled = true;
+				c.stalledSince = now;
+			}
+			else if (now - c.stalledSince > std::chrono::milliseconds(COMLIB_DROP_TIMEOUT_MS))
+			{
+				printf("Consumer was too slow and has been dropped.\n");
+				disconnect(i);
+				continue;
+			}
+
+			return false;
+		}
+
+		c.stalled = false;
+		i++;
+	}
+
+	return true;
+}
+
+bool SocketLib::send(const void* msg, const size_t length, const unsigned int laneIndex)
+{
+	// Consumers would drop the connection over it
+	if (length > SOCKETLIB_MESSAGE_MAX)
+		return false;
+
+	const unsigned int lane = (laneIndex < laneCount) ? laneIndex : laneCount - 1;
+
+	if (!listen())
+		return true; // Nobody can be connected, discarded as without consumers
+
+	accept();
+
+	FrameHeader frame;
+	frame.length = length;
+	frame.lane = lane;
+
+	const size_t total = frameSize(length);
+
+	if (!room(lane, total))
+		return false;
+
+	const char padding[8] = {};
+
+	for (size_t i = 0; i < connections.size(); )
+	{
+		Connection& c = connections[i];
+		long long n = 0;
+
+		// Nothing queued in front of it in any lane, so it goes straight to the socket without a copy
+		bool idle = (c.partialLane < 0);
+
+		for (unsigned int j = 0; j < laneCount; j++)
+			idle = idle && c.offset[j] == c.pending[j].size();
+
+		if (idle)
+		{
+			const Chunk chunks[3] = {
+				{ reinterpret_cast<const char*>(&frame), sizeof(FrameHeader) },
+				{ static_cast<const char*>(msg), length },
+				{ padding, total - sizeof(FrameHeader) - length }
+			};
+
+			n = writeChunks(c.socket, chunks, (chunks[2].length > 0) ? 3 : 2);
+
+			if (n < 0)
+			{
+				printf("Consumer disconnected.\n");
+				disconnect(i);
+				continue;
+			}
+		}
+
+		if ((size_t)n < total)
+		{
+			if (idle)
+			{
+				c.pending[lane].clear();
+				c.offset[lane] = 0;
+			}
+
+			queue(c, frame, static_cast<const char*>(msg), (size_t)n);
+		}
+
+		i++;
+	}
+
+	laneWritten[lane] += total;
+
+	return true;
+}
+
+void SocketLib::flush()
+{
+	if (!listen())
+		return;
+
+	accept();
+
+	for (size_t i = 0; i < connections.size(); )
+	{
+		if (!flush(connections[i]))
+		{
+			printf("Consumer disconnected.\n");
+			disconnect(i);
+			continue;
+		}
+
+		i++;
+	}
+}
+
+char* SocketLib::reserve(const size_t length, const unsigned int laneIndex)
+{
+	if (length > SOCKETLIB_MESSAGE_MAX)
+		return nullptr;
+
+	const unsigned int lane = (laneIndex < laneCount) ? laneIndex : laneCount - 1;
+
+	// Fails like a full ring, so commit cannot
+	if (listen())
+	{
+		accept();
+
+		if (!room(lane, frameSize(length)))
+			return nullptr;
+	}
+
+	if (staging.size() < length)
+		staging.resize(length);
+
+	reservedLane = lane;
+
+	return staging.data();
+}
+
+void SocketLib::commit(char* data, const size_t length)
+{
+	send(data, length, reservedLane);
+}
+
+void SocketLib::receive()
+{
+	// Messages already read are handed out first, the socket is only read again when they ran out
+	// or now and then for higher priority lanes, not once per message
+	const auto now = std::chrono::steady_clock::now();
+	bool empty = true;
+
+	for (unsigned int i = 0; i < laneCount; i++)
+		empty = empty && inboxes[i].read == inboxes[i].data.size();
+
+	if (!empty && now - lastRead < std::chrono::milliseconds(1))
+		return;
+
+	if (!connect() || !writeReplies())
+		return;
+
+	lastRead = now;
+
+	// Everything the socket has, in as few reads as possible
+	while (true)
+	{
+		const size_t used = stream.size();
+		stream.resize(used + SOCKETLIB_READSIZE);
+
+		const long long n = readSome(server, stream.data() + used, SOCKETLIB_READSIZE);
+
+		if (n < 0)
+		{
+			lose();
+			return;
+		}
+
+		stream.resize(used + (size_t)n);
+
+		if ((size_t)n < SOCKETLIB_READSIZE)
+			break;
+	}
+
+	// Whole frames go to the inbox of their lane, a partial one waits for the rest
+	size_t position = 0;
+
+	while (stream.size() - position >= sizeof(FrameHeader))
+	{
+		FrameHeader frame;
+		memcpy(&frame, stream.data() + position, sizeof(FrameHeader));
+
+		// frameSize() would wrap, and nothing after it can be trusted to start a frame
+		if (frame.length > SOCKETLIB_MESSAGE_MAX)
+		{
+			printf("Frame of %llu bytes from %s.\n", frame.length, address.c_str());
+			lose();
+			return;
+		}
+
+		const size_t total = frameSize((size_t)frame.length);
+
+		if (stream.size() - position < total)
+			break;
+
+		Inbox& inbox = inboxes[(frame.lane < laneCount) ? frame.lane : laneCount - 1];
+		inbox.data.insert(inbox.data.end(), stream.begin() + position, stream.begin() + position + total);
+
+		position += total;
+	}
+
+	stream.erase(stream.begin(), stream.begin() + position);
+}
+
+const char* SocketLib::front(Inbox& inbox, size_t& length) const
+{
+	if (inbox.read == inbox.data.size())
+		return nullptr;
+
+	const FrameHeader* frame = reinterpret_cast<const FrameHeader*>(inbox.data.data() + inbox.read);
+	length = (size_t)frame->length;
+
+	return inbox.data.data() + inbox.read + sizeof(FrameHeader);
+}
+
+const char* SocketLib::peek(size_t& length, unsigned int* lane)
+{
+	receive();
+
+	// Lanes in priority order, as with ComLib
+	for (unsigned int i = 0; i < laneCount; i++)
+	{
+		const char* data = front(inboxes[i], length);
+
+		if (data != nullptr)
+		{
+			peekedLane = i;
+
+			if (lane != nullptr)
+				*lane = i;
+
+			return data;
+		}
+	}
+
+	return nullptr;
+}
+
+void SocketLib::release()
+{
+	Inbox& inbox = inboxes[peekedLane];
+
+	inbox.read += frameSize((size_t)reinterpret_cast<FrameHeader*>(inbox.data.data() + inbox.read)->length);
+
+	// Read frames are dropped once they are most of the inbox, what is left stays 8 byte aligned
+	if (inbox.read == inbox.data.size())
+	{
+		inbox.data.clear();
+		inbox.read = 0;
+	}
+	else if (inbox.read >= inbox.data.size() / 2)
+	{
+		inbox.data.erase(inbox.data.begin(), inbox.data.begin() + inbox.read);
+		inbox.read = 0;
+	}
+}
+
+bool SocketLib::recv(char* msg, size_t& length)
+{
+	const char* data = peek(length);
+
+	if (data == nullptr)
+		return false;
+
+	memcpy(msg, data, length);
+	release();
+
+	return true;
+}
+
+size_t SocketLib::recvBatch(char* msgs, const size_t capacity, size_t* lengths, const size_t maxCount)
+{
+	receive();
+
+	size_t count = 0;
+	size_t used = 0;
+
+	for (unsigned int i = 0; i < laneCount && count < maxCount; i++)
+	{
+		size_t length = 0;
+		const char* data = nullptr;
+
+		while (count < maxCount && (data = front(inboxes[i], length)) != nullptr && used + length <= capacity)
+		{
+			memcpy(msgs + used, data, length);
+
+			lengths[count++] = length;
+			used += length;
+
+			peekedLane = i;
+			release();
+		}
+
+		if (data != nullptr) // Stopped on a message, the lanes below wait for it
+			break;
+	}
+
+	return count;
+}
+
+size_t SocketLib::nextLength()
+{
+	size_t length = 0;
+
+	return (peek(length) != nullptr) ? length : 0;
+}
+
+size_t SocketLib::written(const unsigned int laneIndex)
+{
+	return laneWritten[(laneIndex < laneCount) ? laneIndex : laneCount - 1];
+}
+
+size_t SocketLib::consumed(const unsigned int laneIndex)
+{
+	const unsigned int lane = (laneIndex < laneCount) ? laneIndex : laneCount - 1;
+
+	// Frames are queued in order, so what the slowest consumer still has queued is the end of the lane
+	size_t queued = 0;
+
+	for (const Connection& c : connections)
+	{
+		if (c.pending[lane].size() - c.offset[lane] > queued)
+			queued = c.pending[lane].size() - c.offset[lane];
+	}
+
+	return laneWritten[lane] - queued;
+}
+
+unsigned int SocketLib::joins() const
+{
+	return joinCount;
+}
+
+bool SocketLib::writeReplies()
+{
+	if (outgoingOffset == outgoing.size())
+		return true;
+
+	const Chunk chunk = { outgoing.data() + outgoingOffset, outgoing.size() - outgoingOffset };
+	const long long n = writeChunks(server, &chunk, 1);
+
+	if (n < 0)
+	{
+		lose();
+		return false;
+	}
+
+	outgoingOffset += (size_t)n;
+
+	if (outgoingOffset == outgoing.size())
+	{
+		outgoing.clear();
+		outgoingOffset = 0;
+	}
+
+	return true;
+}
+
+bool SocketLib::reply(const void* msg, const size_t length)
+{
+	if (length > SOCKETLIB_MESSAGE_MAX)
+		return false;
+
+	if (!connect())
+		return false;
+
+	const size_t total = frameSize(length);
+
+	if (outgoing.size() - outgoingOffset + total > buffSize)
+		return false;
+
+	// Framed like messages, lane 0. Queued and written together with whatever is still waiting.
+	FrameHeader frame;
+	frame.length = length;
+
+	const size_t start = outgoing.size();
+	outgoing.resize(start + total);
+
+	memcpy(outgoing.data() + start, &frame, sizeof(FrameHeader));
+	memcpy(outgoing.data() + start + sizeof(FrameHeader), msg, length);
+
+	return writeReplies();
+}
+
+bool SocketLib::readReplies(Connection& c)
+{
+	// Replies are small and few, a read of what the socket has is enough
+	const size_t used = c.replies.size();
+	c.replies.resize(used + (64 << 10));
+
+	const long long n = readSome(c.socket, c.replies.data() + used, 64 << 10);
+
+	c.replies.resize(used + ((n > 0) ? (size_t)n : 0));
+
+	return n >= 0;
+}
+
+const char* SocketLib::frontReply(Connection& c, size_t& length) const
+{
+	if (c.replies.size() - c.replyRead < sizeof(FrameHeader))
+		return nullptr;
+
+	const FrameHeader* frame = reinterpret_cast<const FrameHeader*>(c.replies.data() + c.replyRead);
+
+	// Never handed out, peekReply() drops the consumer (badReply)
+	if (frame->length > SOCKETLIB_MESSAGE_MAX)
+		return nullptr;
+
+	if (c.replies.size() - c.replyRead < frameSize((size_t)frame->length))
+		return nullptr;
+
+	length = (size_t)frame->length;
+
+	return c.replies.data() + c.replyRead + sizeof(FrameHeader);
+}
+
+bool SocketLib::badReply(const Connection& c) const
+{
+	if (c.replies.size() - c.replyRead < sizeof(FrameHeader))
+		return false;
+
+	return reinterpret_cast<const FrameHeader*>(c.replies.data() + c.replyRead)->length > SOCKETLIB_MESSAGE_MAX;
+}
+
+const char* SocketLib::peekReply(size_t& length)
+{
+	if (!listen())
+		return nullptr;
+
+	accept();
+
+	for (size_t i = 0; i < connections.size(); )
+	{
+		Connection& c = connections[i];
+		const char* data = frontReply(c, length);
+
+		if (data == nullptr)
+		{
+			if (!readReplies(c) || badReply(c))
+			{
+				printf("Consumer disconnected.\n");
+				disconnect(i);
+				continue;
+			}
+
+			data = frontReply(c, length);
+		}
+
+		if (data != nullptr)
+		{
+			replyConnection = i;
+			return data;
+		}
+
+		i++;
+	}
+
+	return nullptr;
+}
+
+void SocketLib::releaseReply()
+{
+	Connection& c = connections[replyConnection];
+
+	c.replyRead += frameSize((size_t)reinterpret_cast<FrameHeader*>(c.replies.data() + c.replyRead)->length);
+
+	// As with release(), what is left stays 8 byte aligned
+	if (c.replyRead == c.replies.size())
+	{
+		c.replies.clear();
+		c.replyRead = 0;
+	}
+	else if (c.replyRead >= c.replies.size() / 2)
+	{
+		c.replies.erase(c.replies.begin(), c.replies.begin() + c.replyRead);
+		c.replyRead = 0;
+	}
+}
+
+SocketLib::~SocketLib()
+{
+	for (Connection& c : connections)
+		closeSocket(c.socket);
+
+	if (server != -1)
+		closeSocket(server);
+
+	if (listener != -1)
+	{
+		closeSocket(listener);
+
+		if (address.compare(0, 7, "unix://") == 0)
+		{
+#if defined(_WIN32)
+			DeleteFileA(address.substr(7).c_str());
+#else
+			unlink(address.substr(7).c_str());
+#endif
+		}
+	}
+
+#if defined(_WIN32)
+	WSACleanup();
+#endif
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+// Same platform headers and windows.h flags as the ring, winsock is only included by SocketLib.cpp
+#include "ComLib.h"
+
+// Frames are buffered on both ends up to this many bytes per read
+#define SOCKETLIB_READSIZE (1 << 20)
+// Longest message either end sends or accepts, as the most a ring can grow to (BUFFERSIZE_MAX).
+// A frame that claims more comes from a broken or hostile peer, which is dropped.
+#define SOCKETLIB_MESSAGE_MAX (64 << 20)
+// How long a consumer waits before trying to connect again
+#define SOCKETLIB_RETRY_MS 1000
+
+// Socket backend with the send/recv contract of ComLib, for a renderer on another machine or in a container.
+// address is "tcp://host:port" or "unix://path". The producer listens on it and any number of consumers connect,
+// each gets every message sent while it is connected. Which side a process is follows from its first call,
+// like a ComLib BROADCAST reader joining on its first receive.
+// Messages keep their order within a lane, queued lanes are written in priority order.
+// Consumers can reply to the producer over the same connection, see reply().
+// Both ends must share byte order and struct layout, messages are sent as they are in memory.
+class SocketLib
+{
+private:
+	// Precedes every message on the wire, messages are padded to 8 bytes so they can be read in place
+	struct FrameHeader
+	{
+		unsigned long long length = 0;
+		unsigned int lane = 0;
+		unsigned int pad = 0;
+	};
+
+	// Producer side: one connected consumer
+	struct Connection
+	{
+		intptr_t socket = -1;
+		std::vector<char> pending[COMLIB_MAX_LANES];	// Whole frames the socket did not take yet
+		size_t offset[COMLIB_MAX_LANES] = {};			// Bytes of pending already written
+		int partialLane = -1;							// Lane of a frame written halfway, finished before anything else
+		size_t partialEnd = 0;							// End of that frame in pending
+		bool stalled = false;							// A send failed because this consumer is not reading
+		std::chrono::steady_clock::time_point stalledSince;
+		std::vector<char> replies;						// Replies read from the consumer, whole frames and maybe a partial one
+		size_t replyRead = 0;							// Start of the next reply
+	};
+
+	// Consumer side: frames read but not handed out yet, one buffer per lane
+	struct Inbox
+	{
+		std::vector<char> data;
+		size_t read = 0;	// Start of the next frame
+	};
+
+	std::string address;
+	size_t buffSize;			// Most bytes queued per lane and connection before send fails
+	unsigned int laneCount;
+
+	intptr_t listener = -1;
+	std::vector<Connection> connections;
+	size_t laneWritten[COMLIB_MAX_LANES] = {};	// Bytes queued per lane, see written()
+	size_t replyConnection = 0;					// Connection of the reply between peekReply() and releaseReply()
+
+	intptr_t server = -1;
+	std::chrono::steady_clock::time_point lastAttempt;
+	std::chrono::steady_clock::time_point lastRead;
+	std::vector<char> stream;	// Bytes read from the server not parsed into frames yet
+	Inbox inboxes[COMLIB_MAX_LANES];
+	unsigned int peekedLane = 0;
+	std::vector<char> outgoing;	// Replies the socket did not take yet
+	size_t outgoingOffset = 0;
+	unsigned int joinCount = 0;
+
+	std::vector<char> staging;	// Message between reserve() and commit()
+	unsigned int reservedLane = 0;
+
+	static size_t frameSize(const size_t length);
+
+	bool listen();
+	void accept();
+	bool connect();
+	void disconnect(const size_t index);
+	void lose();
+
+	bool flush(Connection& c);
+	bool room(const unsigned int lane, const size_t total);
+	void queue(Connection& c, const FrameHeader& frame, const char* msg, const size_t written);
+
+	void receive();
+	const char* front(Inbox& inbox, size_t& length) const;
+
+	bool writeReplies();
+	bool readReplies(Connection& c);
+	const char* frontReply(Connection& c, size_t& length) const;
+	bool badReply(const Connection& c) const;
+
+public:
+	// laneCount as for ComLib, buffSize bounds what may be queued for a consumer that is not keeping up
+	SocketLib(const std::string& address, const size_t& buffSize, const unsigned int laneCount = 1);
+
+	// Written straight to every consumer with one vectored write, only queued if a socket does not take all of it.
+	// Returns false if a consumer already has buffSize bytes of the lane queued. One that stays that way for
+	// COMLIB_DROP_TIMEOUT_MS is disconnected. Without consumers messages are discarded.
+	bool send(const void* msg, const size_t length, const unsigned int lane = 0);
+
+	// Producer side: write out what sockets did not take during send and accept new consumers.
+	// Nothing is written between sends otherwise, call it regularly.
+	void flush();
+
+	// Staged in this process, then sent by commit. nullptr if send would fail.
+	char* reserve(const size_t length, const unsigned int lane = 0);
+	void commit(char* data, const size_t length);
+
+	// Everything available is read from the socket in one go, then handed out message by message
+	const char* peek(size_t& length, unsigned int* lane = nullptr);
+	void release();
+
+	bool recv(char* msg, size_t& length);
+	size_t recvBatch(char* msgs, const size_t capacity, size_t* lengths, const size_t maxCount);
+	size_t nextLength();
+
+	// Producer side: bytes queued in a lane so far, and bytes every consumer's socket has taken
+	size_t written(const unsigned int lane);
+	size_t consumed(const unsigned int lane);
+
+	// Consumer side: times a connection to the producer was made, see ComLib::joins()
+	unsigned int joins() const;
+
+	// Consumer side: message back to the producer. Returns false while not connected or if buffSize bytes
+	// of replies are already waiting for the socket.
+	bool reply(const void* msg, const size_t length);
+
+	// Producer side: next reply of any consumer, valid until releaseReply()
+	const char* peekReply(size_t& length);
+	void releaseReply();
+
+	~SocketLib();
+};
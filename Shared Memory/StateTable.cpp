@@ -0,0 +1,325 @@
+#include "StateTable.h"
+#include <chrono>
+#include <thread>
+
+#if defined(_WIN32)
+StateTable::StateTable(const std::string& secret, const size_t slotCount, const size_t slotSize)
+{
+	const size_t slotStride = (sizeof(Slot) + slotSize + 63) & ~size_t(63);
+	const size_t headerSize = (sizeof(TableHeader) + 63) & ~size_t(63);
+	const size_t fileSize = headerSize + slotCount * slotStride;
+
+	// Pagefile backed, so every slot starts out zeroed: EMPTY with sequence 0
+	hFileMap = CreateFileMappingA(
+		INVALID_HANDLE_VALUE,
+		NULL,
+		PAGE_READWRITE,
+		(DWORD)((unsigned long long)fileSize >> 32),
+		(DWORD)fileSize,
+		secret.c_str()
+	);
+
+	if (hFileMap == nullptr) {
+		printf("Could not create file mapping object (%d).\n", GetLastError());
+		exit(0);
+	}
+
+	const bool creator = (GetLastError() != ERROR_ALREADY_EXISTS);
+
+	mData = static_cast<char*>(MapViewOfFile(hFileMap, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+
+	if (mData == nullptr) {
+		printf("Could not map view of file (%d).\n", GetLastError());
+		CloseHandle(hFileMap);
+		exit(0);
+	}
+
+	th = reinterpret_cast<TableHeader*>(mData);
+
+	const auto waitStart = std::chrono::steady_clock::now();
+
+	while (!creator && th->ready.load(std::memory_order_acquire) == 0 && std::chrono::steady_clock::now() - waitStart < std::chrono::milliseconds(COMLIB_LOCK_TIMEOUT_MS))
+		std::this_thread::yield();
+
+	// A creator that died before writing the header leaves it to this process. The mapping cannot be replaced
+	// while it is open here, but it is as large as this process would have made it.
+	if (!creator && th->ready.load(std::memory_order_acquire) == 0)
+	{
+		MEMORY_BASIC_INFORMATION region {};
+
+		if (VirtualQuery(mData, &region, sizeof(region)) == 0 || region.RegionSize < fileSize) {
+			printf("Could not finish shared memory object left unfinished (%zu bytes).\n", (size_t)region.RegionSize);
+			UnmapViewOfFile(mData);
+			CloseHandle(hFileMap);
+			exit(0);
+		}
+
+		printf("Finishing shared memory object left unfinished for %d ms.\n", COMLIB_LOCK_TIMEOUT_MS);
+	}
+
+	if (th->ready.load(std::memory_order_acquire) == 0)
+	{
+		th->slotCount = slotCount;
+		th->slotSize = slotSize;
+		th->slotStride = slotStride;
+		th->ready.store(1, std::memory_order_release);
+	}
+}
+#else
+StateTable::StateTable(const std::string& secret, const size_t slotCount, const size_t slotSize)
+{
+	const size_t slotStride = (sizeof(Slot) + slotSize + 63) & ~size_t(63);
+	const size_t headerSize = (sizeof(TableHeader) + 63) & ~size_t(63);
+
+	shmName = "/" + secret;
+	mapSize = headerSize + slotCount * slotStride;
+
+	const size_t fullSize = mapSize;
+	bool creator;
+
+	// A creator that died before its header was ready leaves a segment nobody can attach to, it is replaced
+	for (;;)
+	{
+		creator = true;
+
+		hFileMap = shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+
+		if (hFileMap == -1 && errno == EEXIST) // Another process got there first, attach to its segment
+		{
+			creator = false;
+			hFileMap = shm_open(shmName.c_str(), O_RDWR, 0666);
+		}
+
+		if (hFileMap == -1) {
+			printf("Could not create shared memory object (%d).\n", errno);
+			exit(0);
+		}
+
+		const auto waitStart = std::chrono::steady_clock::now();
+		const auto waited = [&]() { return std::chrono::steady_clock::now() - waitStart > std::chrono::milliseconds(COMLIB_LOCK_TIMEOUT_MS); };
+
+		if (creator)
+		{
+			// ftruncate zeroes the object, so every slot starts out EMPTY with sequence 0
+			if (ftruncate(hFileMap, (off_t)mapSize) == -1) {
+				printf("Could not size shared memory object (%d).\n", errno);
+				close(hFileMap);
+				shm_unlink(shmName.c_str());
+				exit(0);
+			}
+		}
+		else
+		{
+			// The creator may not have sized the object yet
+			struct stat st {};
+			while (fstat(hFileMap, &st) == 0 && (size_t)st.st_size < headerSize && !waited())
+				sched_yield();
+
+			mapSize = (size_t)st.st_size; // The segment keeps the size chosen by its creator
+		}
+
+		mData = nullptr;
+
+		if (mapSize >= headerSize)
+		{
+			mData = static_cast<char*>(mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, hFileMap, 0));
+
+			if (mData == MAP_FAILED) {
+				printf("Could not map shared memory object (%d).\n", errno);
+				mData = nullptr;
+				close(hFileMap);
+				exit(0);
+			}
+
+			th = reinterpret_cast<TableHeader*>(mData);
+
+			while (!creator && th->ready.load(std::memory_order_acquire) == 0 && !waited())
+				sched_yield();
+
+			if (creator || th->ready.load(std::memory_order_acquire) != 0)
+				break;
+
+			munmap(mData, mapSize);
+		}
+
+		printf("Replacing shared memory object left unfinished for %d ms.\n", COMLIB_LOCK_TIMEOUT_MS);
+		ComLib::unlinkStale(shmName, hFileMap);
+		close(hFileMap);
+
+		mapSize = fullSize;
+	}
+
+	if (creator)
+	{
+		th->slotCount = slotCount;
+		th->slotSize = slotSize;
+		th->slotStride = slotStride;
+		th->ready.store(1, std::memory_order_release);
+	}
+
+	th->users.fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
+StateTable::Slot* StateTable::slot(const size_t index) const
+{
+	const size_t headerSize = (sizeof(TableHeader) + 63) & ~size_t(63);
+
+	return reinterpret_cast<Slot*>(mData + headerSize + index * th->slotStride);
+}
+
+void StateTable::empty(Slot* s)
+{
+	// Through the seqlock as well, a reader in the middle of the slot retries and sees it gone
+	const unsigned int sequence = s->sequence.load(std::memory_order_relaxed);
+	s->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	s->state.store(EMPTY, std::memory_order_relaxed);
+
+	s->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+int StateTable::write(const size_t tag, const void* data, const size_t length)
+{
+	if (length > th->slotSize)
+		return -1;
+
+	// Every slot is free before the first write, values a writer before this one left are emptied
+	if (slots.empty() && freeSlots.empty())
+	{
+		for (size_t i = th->slotCount; i > 0; i--)
+		{
+			Slot* s = slot(i - 1);
+
+			if (s->state.load(std::memory_order_relaxed) == USED)
+				empty(s);
+
+			freeSlots.push_back((int)i - 1);
+		}
+	}
+
+	auto known = slots.find(tag);
+
+	if (known == slots.end())
+	{
+		if (freeSlots.empty()) // Table is full
+			return -1;
+
+		known = slots.emplace(tag, freeSlots.back()).first;
+		freeSlots.pop_back();
+	}
+
+	const int index = known->second;
+	Slot* s = slot(index);
+
+	// Only this process writes, the sequence can be read relaxed here
+	const unsigned int sequence = s->sequence.load(std::memory_order_relaxed);
+	s->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	memcpy(reinterpret_cast<char*>(s + 1), data, length);
+	s->length = length;
+	s->tag = tag;
+	s->state.store(USED, std::memory_order_relaxed);
+
+	s->sequence.store(sequence + 2, std::memory_order_release);
+
+	return index;
+}
+
+void StateTable::erase(const size_t tag)
+{
+	const auto known = slots.find(tag);
+
+	if (known == slots.end())
+		return;
+
+	empty(slot(known->second));
+
+	freeSlots.push_back(known->second);
+	slots.erase(known);
+}
+
+int StateTable::find(const size_t tag) const
+{
+	for (size_t index = 0; index < th->slotCount; index++)
+	{
+		const Slot* s = slot(index);
+
+		// The tag is only compared while the slot is not being written
+		unsigned int sequence;
+		bool match;
+
+		do
+		{
+			sequence = s->sequence.load(std::memory_order_acquire);
+			match = (s->state.load(std::memory_order_relaxed) == USED && s->tag == tag);
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while ((sequence & 1) || s->sequence.load(std::memory_order_relaxed) != sequence);
+
+		if (match)
+			return (int)index;
+	}
+
+	return -1;
+}
+
+bool StateTable::read(const int index, const size_t tag, void* data, const size_t length, unsigned int& sequence) const
+{
+	if (index < 0 || (size_t)index >= th->slotCount)
+		return false;
+
+	const Slot* s = slot(index);
+
+	while (true)
+	{
+		const unsigned int before = s->sequence.load(std::memory_order_acquire);
+
+		if (before & 1) // Writer is inside the slot
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		if (before == sequence) // Nothing new
+			return false;
+
+		// The copy may be torn, it only counts if the sequence did not move while it was made
+		const bool match = (s->state.load(std::memory_order_relaxed) == USED && s->tag == tag);
+
+		if (match)
+			memcpy(data, reinterpret_cast<const char*>(s + 1), (s->length < length) ? s->length : length);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (s->sequence.load(std::memory_order_relaxed) != before)
+			continue;
+
+		if (!match) // Erased, and maybe taken by another tag
+			return false;
+
+		sequence = before;
+		return true;
+	}
+}
+
+#if defined(_WIN32)
+StateTable::~StateTable()
+{
+	UnmapViewOfFile((LPCVOID)mData);
+	CloseHandle(hFileMap);
+}
+#else
+StateTable::~StateTable()
+{
+	const bool last = (th->users.fetch_sub(1, std::memory_order_relaxed) == 1);
+
+	munmap(mData, mapSize);
+	close(hFileMap);
+
+	// Unlike a Win32 mapping, a POSIX object outlives its handles until unlinked
+	if (last)
+		shm_unlink(shmName.c_str());
+}
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+// Same platform headers and windows.h flags as the ring
+#include "ComLib.h"
+#include <unordered_map>
+
+// Latest-value slots in shared memory, for state where only the newest value matters (camera, transforms).
+// The producer overwrites a slot in place, the consumer reads whatever is freshest when it needs it.
+// Nothing queues up, so a burst of updates costs one slot write each and the reader never falls behind.
+// Every value has a tag (a node handle) and takes a free slot while it is written. The writer hands out the slots,
+// readers look a tag up once and keep its slot. Exactly one writer process, any number of readers.
+class StateTable
+{
+private:
+#if defined(_WIN32)
+	HANDLE hFileMap;
+#else
+	int hFileMap;			// shm_open file descriptor
+	std::string shmName;	// "/" + secret
+	size_t mapSize;			// Size of the shared memory object
+#endif
+	char* mData;
+
+	struct TableHeader
+	{
+		std::atomic<unsigned int> ready;	// Set once the creator has written the header
+		std::atomic<unsigned int> users;	// Attached processes, the last one to leave unlinks the segment (POSIX)
+		size_t slotCount;
+		size_t slotSize;					// Largest value a slot holds
+		size_t slotStride;					// Slot + value, 64 byte aligned
+	};
+
+	TableHeader* th;
+
+	enum SLOTSTATE { EMPTY = 0, USED = 1 };
+
+	// Seqlock: sequence is odd while the writer is inside the slot, a reader retries if it changed under it
+	struct Slot
+	{
+		std::atomic<unsigned int> sequence;
+		std::atomic<unsigned int> state;
+		size_t tag;
+		size_t length;
+	};
+
+	Slot* slot(const size_t index) const;
+	void empty(Slot* s);
+
+	// Writer: slot of every tag written and not erased, and the slots free for others with the lowest last
+	std::unordered_map<size_t, int> slots;
+	std::vector<int> freeSlots;
+
+public:
+	// slotCount and slotSize are chosen by the process that creates the segment, later processes follow it
+	StateTable(const std::string& secret, const size_t slotCount, const size_t slotSize);
+
+	// Writer: overwrite the value of tag, taking a free slot the first time. Returns the slot, or -1 if every slot
+	// is taken or the value does not fit.
+	int write(const size_t tag, const void* data, const size_t length);
+
+	// Writer: free the slot of tag for another one, readers holding it see tag as gone
+	void erase(const size_t tag);
+
+	// Reader: slot of tag, -1 if it has not been written yet. Cache it, the slot keeps the tag until it is erased.
+	int find(const size_t tag) const;
+
+	// Reader: copy the value of the slot if it still holds tag and changed since sequence.
+	// sequence is updated, start from 0. Returns false if there is nothing new, data is only valid after true.
+	bool read(const int index, const size_t tag, void* data, const size_t length, unsigned int& sequence) const;
+
+	~StateTable();
+};
@@ -0,0 +1,150 @@
+#include "Transport.h"
+
+Transport::Transport(const std::string& secret, const size_t& buffSize, const ComLib::MODE mode, const bool mirrored, const unsigned int laneCount, const std::string& replySecret)
+{
+	std::string address;
+
+#if defined(_WIN32)
+	// getenv is deprecated under /sdl
+	char* value = nullptr;
+	size_t length = 0;
+
+	if (_dupenv_s(&value, &length, TRANSPORT_ENV) == 0 && value != nullptr)
+	{
+		address = value;
+		free(value);
+	}
+#else
+	const char* value = getenv(TRANSPORT_ENV);
+
+	if (value != nullptr)
+		address = value;
+#endif
+
+	if (address.empty() || address == "shm")
+	{
+		com = std::make_unique<ComLib>(secret, buffSize, mode, mirrored, laneCount);
+
+		if (!replySecret.empty())
+			replies = std::make_unique<ComLib>(replySecret, TRANSPORT_REPLYSIZE, ComLib::LOCKED);
+	}
+	else
+	{
+		printf("%s: using %s\n", secret.c_str(), address.c_str());
+		socket = std::make_unique<SocketLib>(address, buffSize, laneCount);
+	}
+}
+
+bool Transport::shared() const
+{
+	return com != nullptr;
+}
+
+std::string Transport::segment(const std::string& secret) const
+{
+	if (shared())
+		return secret;
+
+#if defined(_WIN32)
+	return secret + "_" + std::to_string(GetCurrentProcessId());
+#else
+	return secret + "_" + std::to_string(getpid());
+#endif
+}
+
+bool Transport::send(const void* msg, const size_t length, const unsigned int lane)
+{
+	return com ? com->send(msg, length, lane) : socket->send(msg, length, lane);
+}
+
+void Transport::flush()
+{
+	if (socket)
+		socket->flush();
+}
+
+char* Transport::reserve(const size_t length, const unsigned int lane)
+{
+	return com ? com->reserve(length, lane) : socket->reserve(length, lane);
+}
+
+void Transport::commit(char* data, const size_t length)
+{
+	if (com)
+		com->commit(data, length);
+	else
+		socket->commit(data, length);
+}
+
+const char* Transport::peek(size_t& length, unsigned int* lane)
+{
+	return com ? com->peek(length, lane) : socket->peek(length, lane);
+}
+
+void Transport::release()
+{
+	if (com)
+		com->release();
+	else
+		socket->release();
+}
+
+bool Transport::recv(char* msg, size_t& length)
+{
+	return com ? com->recv(msg, length) : socket->recv(msg, length);
+}
+
+size_t Transport::recvBatch(char* msgs, const size_t capacity, size_t* lengths, const size_t maxCount)
+{
+	return com ? com->recvBatch(msgs, capacity, lengths, maxCount) : socket->recvBatch(msgs, capacity, lengths, maxCount);
+}
+
+size_t Transport::nextLength()
+{
+	return com ? com->nextLength() : socket->nextLength();
+}
+
+size_t Transport::written(const unsigned int lane)
+{
+	return com ? com->written(lane) : socket->written(lane);
+}
+
+size_t Transport::consumed(const unsigned int lane)
+{
+	return com ? com->consumed(lane) : socket->consumed(lane);
+}
+
+void Transport::autoResize(const size_t minSize, const size_t maxSize)
+{
+	if (com)
+		com->autoResize(minSize, maxSize);
+}
+
+unsigned int Transport::joins() const
+{
+	return com ? com->joins() : socket->joins();
+}
+
+bool Transport::reply(const void* msg, const size_t length)
+{
+	if (socket)
+		return socket->reply(msg, length);
+
+	return replies && replies->send(msg, length);
+}
+
+const char* Transport::peekReply(size_t& length)
+{
+	if (socket)
+		return socket->peekReply(length);
+
+	return replies ? replies->peek(length) : nullptr;
+}
+
+void Transport::releaseReply()
+{
+	if (socket)
+		socket->releaseReply();
+	else
+		replies->release();
+}
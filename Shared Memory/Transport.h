@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ComLib.h"
+#include "SocketLib.h"
+#include <memory>
+
+// Environment variable naming a socket address (see SocketLib), shared memory is used when it is not set
+#define TRANSPORT_ENV "MAYARENDER_TRANSPORT"
+// Size of the segment replies go through over shared memory
+#define TRANSPORT_REPLYSIZE 1<<20
+
+// The send/recv contract of ComLib over the backend chosen at runtime: a ComLib segment when both processes
+// are on one machine, a SocketLib connection when TRANSPORT_ENV is set, e.g. to put the renderer on another
+// machine or in a container. Over shared memory every call goes straight to ComLib.
+class Transport
+{
+private:
+	std::unique_ptr<ComLib> com;
+	std::unique_ptr<SocketLib> socket;
+	std::unique_ptr<ComLib> replies;
+
+public:
+	// Arguments as for ComLib, mode and mirrored only apply to shared memory.
+	// replySecret names a LOCKED segment consumers reply through over shared memory, none if empty.
+	// Over a socket replies go back over the consumer's connection.
+	Transport(const std::string& secret, const size_t& buffSize, const ComLib::MODE mode = ComLib::LOCKED, const bool mirrored = false, const unsigned int laneCount = 1, const std::string& replySecret = "");
+
+	// Whether the other side shares this machine's memory. Anything else kept in shared memory next to
+	// the transport (blobs, state slots) is only seen by the other side when it does.
+	bool shared() const;
+
+	// Name for a segment that lives next to the transport: secret itself over shared memory,
+	// one private to this process otherwise, so two processes on one host do not share it by accident
+	std::string segment(const std::string& secret) const;
+
+	bool send(const void* msg, const size_t length, const unsigned int lane = 0);
+	void flush();	// See SocketLib, nothing to do over shared memory
+	char* reserve(const size_t length, const unsigned int lane = 0);
+	void commit(char* data, const size_t length);
+
+	const char* peek(size_t& length, unsigned int* lane = nullptr);
+	void release();
+	bool recv(char* msg, size_t& length);
+	size_t recvBatch(char* msgs, const size_t capacity, size_t* lengths, const size_t maxCount);
+	size_t nextLength();
+
+	size_t written(const unsigned int lane);
+	size_t consumed(const unsigned int lane);
+	void autoResize(const size_t minSize, const size_t maxSize);	// See ComLib, socket queues grow as needed anyway
+	unsigned int joins() const;
+
+	// Consumers to the producer, see SocketLib::reply(). Any number of consumers can reply, one producer reads them.
+	bool reply(const void* msg, const size_t length);
+	const char* peekReply(size_t& length);
+	void releaseReply();
+};
@@ -19,14 +19,39 @@ out vec3 fragNormal;
 
 // NOTE: Add here your custom variables
 
+// Quantized vertices (VERTEX_QUANTIZED): positions 0 to 1 across the bounds,
+// normals 0 to 1 on the octahedron in xy. Uvs arrive as floats either way.
+uniform int quantized;
+uniform vec3 boundsMin;
+uniform vec3 boundsMax;
+
+// Octahedron back to the sphere, the lower half is folded over the upper
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float fold = max(-n.z, 0.0);
+    n.x += (n.x >= 0.0) ? -fold : fold;
+    n.y += (n.y >= 0.0) ? -fold : fold;
+    return normalize(n);
+}
+
 void main()
 {
+    vec3 position = vertexPosition;
+    vec3 normal = vertexNormal;
+
+    if (quantized == 1)
+    {
+        position = mix(boundsMin, boundsMax, vertexPosition);
+        normal = octahedralDecode(vertexNormal.xy*2.0 - 1.0);
+    }
+
     // Send vertex attributes to fragment shader
-    fragPosition = vec3(matModel*vec4(vertexPosition, 1.0));
+    fragPosition = vec3(matModel*vec4(position, 1.0));
     fragTexCoord = vertexTexCoord;
     fragColor = vertexColor;
-    fragNormal = normalize(vec3(matNormal*vec4(vertexNormal, 1.0)));
+    fragNormal = normalize(vec3(matNormal*vec4(normal, 1.0)));
 
     // Calculate final vertex position
-    gl_Position = mvp*vec4(vertexPosition, 1.0);
+    gl_Position = mvp*vec4(position, 1.0);
 }